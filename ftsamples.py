@@ -0,0 +1,59 @@
+"""Compact sample files (ft2csv -R); see include/samples.h.
+
+A sample file is a sequence of self-describing segments. ft2csv puts the
+samples that need 32 or 64 bits into segments of their own, so a file with
+several segments is read back grouped by width: the order of the samples is
+preserved within each segment only. store_compact() writes a single segment,
+which preserves the order of all samples (e.g., after shuffling).
+"""
+
+import os
+import struct
+
+import numpy
+
+SAMPLES_MAGIC = b'FTSMPL\0\0'
+SAMPLES_HEADER_SIZE = 32
+
+SAMPLES_DTYPES = [numpy.dtype('u2'), numpy.dtype('u4'), numpy.dtype('u8')]
+
+def is_compact_file(fname):
+    "Does fname hold compact samples (ft2csv -R) rather than float32?"
+    with open(fname, 'rb') as f:
+        return f.read(len(SAMPLES_MAGIC)) == SAMPLES_MAGIC
+
+def load_compact_file(fname, mode):
+    "Map each segment of a compact sample file."
+    size = os.stat(fname).st_size
+    segments = []
+    offset = 0
+    with open(fname, 'rb') as f:
+        while offset + SAMPLES_HEADER_SIZE <= size:
+            f.seek(offset)
+            magic, dtype = struct.unpack('8s8s', f.read(16))
+            if magic != SAMPLES_MAGIC:
+                raise IOError('%s: corrupt sample segment at offset %d'
+                              % (fname, offset))
+            dtype = numpy.dtype(dtype.rstrip(b'\0').decode())
+            count, = struct.unpack(dtype.str[0] + 'Q', f.read(8))
+            offset += SAMPLES_HEADER_SIZE
+            segments.append(numpy.memmap(fname, dtype=dtype, mode=mode,
+                                         offset=offset, shape=(count,)))
+            # segments are padded to a multiple of eight bytes
+            offset += (count * dtype.itemsize + 7) // 8 * 8
+    if len(segments) == 1:
+        return segments[0]
+    else:
+        # concatenated files: widen to a common type
+        return numpy.concatenate(segments)
+
+def store_compact(a, fd):
+    "Store integer samples, in order, in the narrowest type that fits all."
+    top = a.max() if len(a) else 0
+    for dtype in SAMPLES_DTYPES:
+        if top <= numpy.iinfo(dtype).max:
+            break
+    fd.write(struct.pack('=8s8sQQ', SAMPLES_MAGIC, dtype.str.encode(),
+                         len(a), 0))
+    a.astype(dtype).tofile(fd)
+    fd.write(b'\0' * (-len(a) * dtype.itemsize % 8))
@@ -0,0 +1,54 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stdint.h>
+
+#include "outbuf.h"
+
+/* Columnar sample files (ft2csv -C).
+ *
+ * A 256-byte header is followed by one array per column, in the order listed
+ * in the header. Each array holds nr_rows values of the given NumPy type
+ * (native byte order) and starts at the given file offset, which is aligned
+ * to the column's element size. A column can thus be loaded without copying,
+ * e.g.,
+ *
+ *	numpy.memmap(f, dtype=dtype, mode='r', offset=offset, shape=(nr_rows,))
+ */
+
+#define COLUMNS_MAGIC   "FTCOLS\0"
+#define COLUMNS_VERSION 1
+
+struct column_desc {
+	char     name[16];
+	char     dtype[8];
+	uint64_t offset;
+};
+
+#define NR_SAMPLE_COLUMNS 7
+
+struct column_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t nr_columns;
+	uint64_t nr_rows;
+	struct column_desc columns[NR_SAMPLE_COLUMNS];
+	uint8_t  reserved[8];
+};
+
+/* One sample. For single-record events, start and end are zero and exec is
+ * the recorded value. */
+struct sample_row {
+	uint64_t start;
+	uint64_t end;
+	uint64_t exec;
+	uint32_t seq_no;
+	uint16_t pid;
+	uint8_t  cpu;
+	uint8_t  irq_count;
+};
+
+/* Transpose a file of struct sample_row records into columnar format. */
+int write_columns(int rows, struct outbuf* out);
+
+#endif
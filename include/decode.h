@@ -0,0 +1,69 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h>
+
+#include "timestamp.h"
+#include "sched_trace.h"
+
+/* Decoding of traces recorded on a machine of the other byte order.
+ *
+ * A foreign record is converted to the native layout in place: integers are
+ * byte-swapped and bitfields are moved to where the native compiler allocates
+ * them (gcc allocates bitfields from the most significant bit on big-endian
+ * machines and from the least significant bit on little-endian ones). For
+ * Feather-Trace records, the conversion is a fixed byte shuffle plus a lookup
+ * for the flags byte; on x86, SSSE3 and AVX2 kernels convert one and two
+ * records per instruction, respectively, selected at runtime based on the
+ * CPU. sched_trace records are converted according to their type.
+ *
+ * The byte order of a trace can be detected from its contents: sequence
+ * numbers of consecutive Feather-Trace records are close to each other, and
+ * job numbers and times in sched_trace records are small, in the right byte
+ * order only.
+ *
+ * ft_decode() and st_decode() convert a whole trace in one pass before it is
+ * processed. On a private mapping, this copies every page of the trace into
+ * anonymous memory: a foreign trace then costs its full size in memory and is
+ * read twice. ft2csv, ftdump, and the sched_trace tools (load.c) decode this
+ * way, since they access the records in no fixed order, from several threads,
+ * or keep all of them. Readers that see each record once convert records as
+ * they read them instead, with ft_needs_swap() and ft_swap(): ftmerge and
+ * struct reorder_stream. ftsort converts the records in place, as it writes the
+ * trace back in native order anyway.
+ */
+
+enum trace_order {
+	TRACE_AUTO,
+	TRACE_NATIVE,
+	TRACE_SWAPPED,
+};
+
+/* Parse "auto", "native", or "swapped". Returns 0 on success. */
+int parse_trace_order(const char* str, enum trace_order* order);
+
+/* records to inspect when detecting the byte order */
+#define DETECT_RECORDS 4096
+
+int ft_looks_swapped(const struct timestamp* ts, size_t count);
+void ft_swap(struct timestamp* ts, size_t count);
+
+/* Name of the selected kernel. The kernel is selected on first use, which
+ * must not happen concurrently. */
+const char* ft_swap_kernel(void);
+
+/* Resolve TRACE_AUTO. Returns non-zero if the records need to be
+ * converted. */
+int ft_needs_swap(const struct timestamp* ts, size_t count,
+		  enum trace_order order);
+
+/* Resolve TRACE_AUTO and convert the records if needed. Returns non-zero if
+ * they were converted. */
+int ft_decode(struct timestamp* ts, size_t count, enum trace_order order);
+
+int st_looks_swapped(const struct st_event_record* rec, size_t count);
+void st_swap(struct st_event_record* rec, size_t count);
+int st_decode(struct st_event_record* rec, size_t count,
+	      enum trace_order order);
+
+#endif
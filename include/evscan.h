@@ -0,0 +1,40 @@
+#ifndef EVSCAN_H
+#define EVSCAN_H
+
+#include <stdint.h>
+
+#include "timestamp.h"
+
+/* Fast scans for records with particular event IDs.
+ *
+ * The event ID sits at a fixed offset in each record, so a block of records
+ * can be classified at once. On x86, SSSE3 and AVX2 kernels test 16 and 32
+ * records per iteration, respectively; the kernel is selected at runtime
+ * based on the CPU. Elsewhere, a scalar loop is used.
+ */
+
+struct event_set {
+	uint8_t member[256];
+	/* bit (id >> 4) & 7 of nibble_bits[id >> 7][id & 0xf] is set for each
+	 * member, for vectorized lookups */
+	uint8_t nibble_bits[2][16];
+};
+
+void event_set_init(struct event_set* set);
+void event_set_add(struct event_set* set, uint8_t id);
+void event_set_remove(struct event_set* set, uint8_t id);
+
+static inline int event_set_contains(const struct event_set* set, uint8_t id)
+{
+	return set->member[id];
+}
+
+/* First record in [start, end) whose event is in set, or end. */
+struct timestamp* find_event(struct timestamp* start, struct timestamp* end,
+			     const struct event_set* set);
+
+/* Name of the selected kernel. The kernel is selected on first use, which
+ * must not happen concurrently. */
+const char* find_event_kernel(void);
+
+#endif
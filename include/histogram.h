@@ -0,0 +1,39 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log-linear histogram of 64-bit samples.
+ *
+ * Values below 2^sub_bits are counted exactly. Larger values are counted in
+ * buckets that split each power-of-two range into 2^sub_bits equal parts, so
+ * that the relative error of reported quantiles is at most 2^-sub_bits. The
+ * bucket array grows with the largest value seen. Histograms with the same
+ * sub_bits can be merged.
+ */
+
+#define DEFAULT_HISTOGRAM_SUB_BITS 7
+
+struct histogram {
+	unsigned int sub_bits;
+	uint64_t* counts;
+	size_t    nr_counts;
+
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	double   sum;
+};
+
+void init_histogram(struct histogram* h, unsigned int sub_bits);
+void free_histogram(struct histogram* h);
+
+void histogram_add(struct histogram* h, uint64_t value);
+void histogram_merge(struct histogram* into, struct histogram* from);
+
+/* The p-th percentile (nearest rank), accurate to the bucket resolution. */
+uint64_t histogram_percentile(struct histogram* h, double p);
+double histogram_mean(struct histogram* h);
+
+#endif
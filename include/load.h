@@ -2,6 +2,10 @@
 #define LOAD_H
 
 #include "sched_trace.h"
+#include "decode.h"
+
+/* byte order of the loaded traces, detected per file by default */
+extern enum trace_order load_order;
 
 int map_trace(const char *name, void **start, void **end, size_t *size);
 struct heap* load(char **files, int no_files, unsigned int *count);
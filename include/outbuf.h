@@ -0,0 +1,72 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Large-block output buffer. Data is either flushed to a file descriptor with
+ * write(2) once OUTBUF_FLUSH_SIZE bytes have accumulated, or, if fd is
+ * negative, kept in memory. */
+struct outbuf {
+	int    fd;
+	char*  buf;
+	size_t size;
+	size_t fill;
+	int    error;
+};
+
+#define OUTBUF_FLUSH_SIZE (256 * 1024)
+
+void outbuf_init(struct outbuf* ob, int fd);
+int  outbuf_flush(struct outbuf* ob);
+void outbuf_grow(struct outbuf* ob, size_t len);
+/* flush and release the buffer (the descriptor is left open) */
+int  outbuf_release(struct outbuf* ob);
+
+/* Make room for at least len more bytes. */
+static inline char* outbuf_reserve(struct outbuf* ob, size_t len)
+{
+	if (ob->size - ob->fill < len)
+		outbuf_grow(ob, len);
+	return ob->buf + ob->fill;
+}
+
+static inline void outbuf_write(struct outbuf* ob, const void* data,
+				size_t len)
+{
+	memcpy(outbuf_reserve(ob, len), data, len);
+	ob->fill += len;
+}
+
+extern const char outbuf_digit_pairs[200];
+
+/* Append the decimal representation of val, as printf("%llu") would. */
+static inline void outbuf_put_u64(struct outbuf* ob, uint64_t val)
+{
+	char tmp[20];
+	char* pos = tmp + sizeof(tmp);
+	size_t len;
+
+	while (val >= 100) {
+		pos -= 2;
+		memcpy(pos, outbuf_digit_pairs + 2 * (val % 100), 2);
+		val /= 100;
+	}
+	if (val >= 10) {
+		pos -= 2;
+		memcpy(pos, outbuf_digit_pairs + 2 * val, 2);
+	} else
+		*--pos = '0' + val;
+
+	len = tmp + sizeof(tmp) - pos;
+	memcpy(outbuf_reserve(ob, len), pos, len);
+	ob->fill += len;
+}
+
+static inline void outbuf_put_str(struct outbuf* ob, const char* str)
+{
+	outbuf_write(ob, str, strlen(str));
+}
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef _REORDER_H_
+#define _REORDER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "timestamp.h"
+#include "histogram.h"
+#include "decode.h"
+#include "segments.h"
+
+/* Look-ahead reordering of records by sequence number.
+ *
+ * Records that were stored out of order are moved back to the position at
+ * which the next expected sequence number is missing, provided that the
+ * record is found within the look-ahead window and that the move does not
+ * place it before an earlier record of the same CPU or task.
+ *
+ * The window starts out with LOOK_AHEAD records and adapts to the disorder
+ * in the trace: each record that trails the highest sequence number seen
+ * before it is late by the difference, which bounds the window needed to
+ * move it back. The window is doubled as soon as a record is late by half
+ * of it and halved once per epoch in which no record was late by more than
+ * an eighth of it, within [MIN_LOOK_AHEAD, MAX_LOOK_AHEAD].
+ */
+
+#define LOOK_AHEAD 1024
+#define MIN_LOOK_AHEAD 128
+#define MAX_LOOK_AHEAD 32768
+#define MAX_NR_NOT_IN_RANGE 5
+
+struct reorder_stats {
+	unsigned int holes;
+	unsigned int reordered;
+	unsigned int aborted_moves;
+
+	/* how far late records trail the highest sequence number before them */
+	struct histogram lateness;
+	unsigned int min_look_ahead;
+	unsigned int max_look_ahead;
+};
+
+void init_reorder_stats(struct reorder_stats* stats);
+void free_reorder_stats(struct reorder_stats* stats);
+
+struct reorder_window;
+
+/* Reorder [start, end) in place with a window of look_ahead records, or an
+ * adaptive one if look_ahead is zero. If log is non-NULL, holes and refused
+ * moves are reported there. Only records that change are stored, and written
+ * (if non-NULL) is called for each of them. */
+void reorder(struct timestamp* start, struct timestamp* end,
+	     unsigned int look_ahead,
+	     struct reorder_stats* stats, FILE* log,
+	     void (*written)(struct timestamp* ts));
+
+/* The same, through a window set up by the caller (e.g., to collect segments
+ * or restored from a snapshot). The records held in the window come before
+ * start; they are written to the slots before it. If snapshot is non-NULL, it
+ * is called right before the record for snapshot_at is popped, with the next
+ * record to push. */
+void reorder_through(struct reorder_window* w,
+		     struct timestamp* start, struct timestamp* end,
+		     void (*written)(struct timestamp* ts),
+		     struct timestamp* snapshot_at,
+		     void (*snapshot)(struct reorder_window* w,
+				      struct timestamp* in));
+
+/* The reordering engine: records are pushed in file order and popped in
+ * sequence-number order. Push records until reorder_window_full() (or no
+ * more records follow) before each pop; pop without pushing while it is.
+ *
+ * Each record occupies a slot; slots are assigned in file order and reused
+ * once the window is compacted. A record that is moved is taken out of its
+ * slot instead of shifting the records before it, and the sequentiality
+ * constraint is checked against the first held record of the same CPU and
+ * task. Searches that do not end within a few records continue in a segment
+ * tree over the slots, so that each record costs O(log nr_slots) time
+ * rather than O(look_ahead). There are four slots per record in the window;
+ * they are reallocated when the window grows. */
+
+struct reorder_queue {
+	int32_t first, last;
+};
+
+struct seqno_range {
+	uint32_t min, max;
+};
+
+struct reorder_window {
+	struct timestamp* records;
+	size_t nr_slots;
+
+	unsigned int look_ahead;
+	int adaptive;
+	/* highest sequence number pushed and how many records were far ahead
+	 * of it in a row; isolated ones are not trusted */
+	uint32_t max_seqno;
+	int nr_far_ahead;
+	/* records left in the current epoch, and the highest lateness in it */
+	uint64_t epoch_left;
+	uint32_t epoch_lateness;
+
+	/* held records of each CPU and task, in slot order; records of
+	 * TS_SEND_RESCHED_START and of PID 0 are not tracked */
+	struct reorder_queue  by_cpu[256];
+	struct reorder_queue* by_pid;
+	int32_t* cpu_next;
+	int32_t* pid_next;
+
+	/* segment tree over the slots: range of the held sequence numbers */
+	struct seqno_range* tree;
+	uint8_t* held;
+
+	size_t head;       /* first held slot */
+	size_t tail;       /* next free slot */
+	/* leaves in [synced_head, head) and [synced_tail, tail) are not yet
+	 * reflected in the inner nodes */
+	size_t synced_head;
+	size_t synced_tail;
+	size_t nr_held;
+
+	uint64_t count;    /* records popped so far */
+	uint32_t last_seqno;
+	/* last_seqno was popped before, by an earlier reordering */
+	int resumed;
+
+	struct reorder_stats* stats;
+	FILE* log;
+	/* if non-NULL, popped records are added to it */
+	struct segment_index* segments;
+};
+
+void init_reorder_window(struct reorder_window* w,
+			 struct reorder_stats* stats, FILE* log);
+void free_reorder_window(struct reorder_window* w);
+/* Use a window of look_ahead records that does not adapt. */
+void fix_reorder_window(struct reorder_window* w, unsigned int look_ahead);
+/* The state of a window from which reordering can be resumed, e.g., by a
+ * later process. The held records are saved separately, in slot order. */
+struct reorder_snapshot {
+	uint32_t look_ahead;
+	uint32_t last_seqno;
+	uint32_t max_seqno;
+	int32_t  nr_far_ahead;
+	uint64_t epoch_left;
+	uint32_t epoch_lateness;
+	uint32_t popped;   /* last_seqno is valid */
+	uint64_t nr_held;
+};
+
+/* held must have room for w->nr_held records */
+void reorder_save(const struct reorder_window* w, struct reorder_snapshot* s,
+		  struct timestamp* held);
+/* w must be freshly initialized */
+void reorder_restore(struct reorder_window* w,
+		     const struct reorder_snapshot* s,
+		     const struct timestamp* held);
+
+static inline int reorder_window_full(const struct reorder_window* w)
+{
+	return w->nr_held >= w->look_ahead;
+}
+
+void reorder_push(struct reorder_window* w, const struct timestamp* ts);
+/* Returns 0 if no record is held. */
+int reorder_pop(struct reorder_window* w, struct timestamp* ts);
+
+/* Reorder a stream of records read from a file descriptor (e.g., a pipe)
+ * with the same result as reorder() on the complete file. Only a bounded
+ * window of records is kept in memory. */
+struct reorder_stream {
+	int fd;
+	int eof;
+	/* byte order of the records; TRACE_AUTO is resolved on the first
+	 * read */
+	enum trace_order order;
+
+	struct timestamp* buf;
+	size_t capacity;   /* in records */
+	size_t pos;        /* next record to push */
+	size_t fill;       /* in bytes, may include a partial record */
+
+	struct reorder_window window;
+	struct timestamp current;
+
+	uint64_t count;    /* records returned so far */
+
+	struct reorder_stats stats;
+	FILE* log;
+};
+
+void init_reorder_stream(struct reorder_stream* s, int fd);
+void free_reorder_stream(struct reorder_stream* s);
+
+/* Next record in sequence-number order, or NULL at the end of the stream.
+ * The record remains valid until the next call. */
+struct timestamp* reorder_next(struct reorder_stream* s);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SAMPLES_H
+#define SAMPLES_H
+
+#include <stdint.h>
+
+#include "outbuf.h"
+
+/* Compact raw sample files (ft2csv -R).
+ *
+ * A sample file is a sequence of segments. Each segment consists of a 32-byte
+ * header followed by nr_samples unsigned integers of the NumPy type given in
+ * the header (native byte order), padded to a multiple of eight bytes.
+ *
+ * Samples are stored losslessly in the narrowest type that can represent
+ * them: ft2csv writes the samples that fit into uint16 (typical overheads) to
+ * one segment, and the few outliers that require uint32 or uint64 to separate
+ * segments. The relative order of samples within each segment is preserved.
+ *
+ * Since every segment is self-describing, sample files can be combined by
+ * simple concatenation. Each segment can be loaded without copying, e.g.,
+ *
+ *	numpy.memmap(f, dtype=dtype, mode='r', offset=32, shape=(nr_samples,))
+ */
+
+#define SAMPLES_MAGIC "FTSMPL\0"
+
+struct sample_header {
+	char     magic[8];
+	char     dtype[8];
+	uint64_t nr_samples;
+	uint64_t reserved;
+};
+
+/* Write the uint64_t samples spooled in the given file as segments. */
+int write_samples(int spool, struct outbuf* out);
+
+#endif
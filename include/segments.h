@@ -0,0 +1,111 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "timestamp.h"
+
+/* Segment index of a sorted trace (ftsort -i).
+ *
+ * A segment is a maximal run of records with consecutive sequence numbers.
+ * The index is stored next to the trace, in <trace>.seg: a 48-byte header is
+ * followed by nr_segments entries in file order (native byte order). Within
+ * a segment, no record has to be checked for holes, and work can be split at
+ * segment boundaries without looking across them.
+ *
+ * An index is only used if the trace file still has the size and the
+ * modification time recorded in the header, if the checksum of a sample of
+ * (at most SEGMENTS_CHECKSUM_SAMPLES) evenly spaced records matches, and if
+ * the first and last sequence numbers of each segment match the trace;
+ * otherwise it is assumed to be stale and ignored.
+ */
+
+#define SEGMENTS_MAGIC   "FTSEGS\0"
+#define SEGMENTS_VERSION 2
+#define SEGMENTS_EXT     ".seg"
+
+#define SEGMENTS_CHECKSUM_SAMPLES 4096
+
+struct segment_header {
+	char     magic[8];
+	uint32_t version;
+	uint32_t checksum;    /* of the sampled records */
+	uint64_t nr_records;
+	uint64_t nr_segments;
+	uint64_t trace_size;  /* of the trace file, in bytes */
+	uint64_t trace_mtime; /* of the trace file, in ns */
+};
+
+struct segment {
+	uint64_t first;   /* index of the first record */
+	uint64_t count;
+	uint32_t seq_no;  /* of the first record */
+	uint32_t reserved;
+};
+
+struct segment_index {
+	struct segment* segs;
+	size_t nr, size;
+	uint64_t nr_records;
+};
+
+void init_segment_index(struct segment_index* idx);
+void free_segment_index(struct segment_index* idx);
+
+void segment_index_open(struct segment_index* idx, uint64_t pos,
+			uint32_t seq_no);
+
+/* Append the record at the given index, which must follow the last one
+ * added. A new segment starts unless seq_no continues the last one. */
+static inline void segment_index_add(struct segment_index* idx, uint64_t pos,
+				     uint32_t seq_no)
+{
+	struct segment* last;
+
+	if (idx->nr) {
+		last = idx->segs + idx->nr - 1;
+		if (last->seq_no + (uint32_t) last->count == seq_no) {
+			last->count++;
+			idx->nr_records = pos + 1;
+			return;
+		}
+	}
+	segment_index_open(idx, pos, seq_no);
+}
+
+/* Add the records ts[0, count), which follow the last one added. */
+void segment_index_scan(struct segment_index* idx, const struct timestamp* ts,
+			size_t count);
+/* Drop the records from the given index on. */
+void segment_index_truncate(struct segment_index* idx, uint64_t count);
+/* Add the records of src, whose indices are relative to offset. */
+void segment_index_append(struct segment_index* idx,
+			  const struct segment_index* src, uint64_t offset);
+
+/* The segment that contains the record at pos. */
+const struct segment* segment_of(const struct segment_index* idx,
+				 uint64_t pos);
+
+/* Index of the record after the end of the segment that contains pos. */
+static inline uint64_t segment_end(const struct segment_index* idx,
+				   uint64_t pos)
+{
+	const struct segment* s = segment_of(idx, pos);
+
+	return s->first + s->count;
+}
+
+/* Write the index of the trace, whose records ts must be in the file
+ * already. */
+int write_segment_index(const char* trace, const struct timestamp* ts,
+			const struct segment_index* idx);
+
+/* Load the index of the given trace, if there is a valid one. If appended is
+ * set, records may have been appended to the trace since the index was
+ * written; then only the first count records are checked, and the size and
+ * the modification time of the file are not. Returns 0 on success. */
+int load_segment_index(const char* trace, const struct timestamp* ts,
+		       size_t count, int appended, struct segment_index* idx);
+
+#endif
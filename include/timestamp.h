@@ -1,6 +1,7 @@
 #ifndef TIMESTAMP_H
 #define TIMESTAMP_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum task_type_marker {
@@ -9,23 +10,99 @@ enum task_type_marker {
 	TSK_UNKNOWN
 };
 
-/* Note: bitfields are highly non-portable (allocation is completely
- * implementation-defined).  Make sure you use the *same* compiler as the one
- * used for the kernel itself (this works with gcc in practice, but is not
- * *guaranteed* to work).  Patches to get rid of the bitfields (without
- * enlarging the structure) are highly welcome.
+/* The kernel declares the first word as the bitfields timestamp:48 and pid:16
+ * and the byte after the event ID as task_type:2, irq_flag:1, and
+ * irq_count:5. Bitfield allocation is implementation-defined, so the fields
+ * are extracted explicitly here, for the layout in which gcc allocates them:
+ * from the least significant bit on little-endian machines and from the most
+ * significant bit on big-endian ones. Define TS_LAYOUT_LSB_FIRST or
+ * TS_LAYOUT_MSB_FIRST to override the choice.
  */
 struct timestamp {
-	uint64_t		timestamp:48;
-	uint64_t		pid:16;
+	uint64_t		word;	/* timestamp and pid */
 	uint32_t		seq_no;
 	uint8_t			cpu;
 	uint8_t			event;
-	uint8_t			task_type:2;
-	uint8_t			irq_flag:1;
-	uint8_t			irq_count:5;
+	uint8_t			flags;	/* task_type, irq_flag, irq_count */
+	uint8_t			pad;
 };
 
+#if !defined(TS_LAYOUT_LSB_FIRST) && !defined(TS_LAYOUT_MSB_FIRST)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TS_LAYOUT_MSB_FIRST
+#else
+#define TS_LAYOUT_LSB_FIRST
+#endif
+#endif
+
+#ifdef TS_LAYOUT_MSB_FIRST
+#define TS_TIMESTAMP_SHIFT	16
+#define TS_PID_SHIFT		0
+#define TS_TASK_TYPE_SHIFT	6
+#define TS_IRQ_FLAG_SHIFT	5
+#define TS_IRQ_COUNT_SHIFT	0
+#else
+#define TS_TIMESTAMP_SHIFT	0
+#define TS_PID_SHIFT		48
+#define TS_TASK_TYPE_SHIFT	0
+#define TS_IRQ_FLAG_SHIFT	2
+#define TS_IRQ_COUNT_SHIFT	3
+#endif
+
+#define TS_TIMESTAMP_MASK	0xffffffffffffull
+#define TS_PID_MASK		0xffff
+#define TS_TASK_TYPE_MASK	0x3
+#define TS_IRQ_FLAG_MASK	0x1
+#define TS_IRQ_COUNT_MASK	0x1f
+
+/* flags byte with the given fields */
+#define TS_FLAGS(task_type, irq_flag, irq_count)			\
+	((uint8_t) (((task_type) & TS_TASK_TYPE_MASK) << TS_TASK_TYPE_SHIFT | \
+		    ((irq_flag) & TS_IRQ_FLAG_MASK) << TS_IRQ_FLAG_SHIFT |   \
+		    ((irq_count) & TS_IRQ_COUNT_MASK) << TS_IRQ_COUNT_SHIFT))
+
+static inline uint64_t ts_timestamp(const struct timestamp* ts)
+{
+	return (ts->word >> TS_TIMESTAMP_SHIFT) & TS_TIMESTAMP_MASK;
+}
+
+static inline uint16_t ts_pid(const struct timestamp* ts)
+{
+	return (ts->word >> TS_PID_SHIFT) & TS_PID_MASK;
+}
+
+static inline uint8_t ts_task_type(const struct timestamp* ts)
+{
+	return (ts->flags >> TS_TASK_TYPE_SHIFT) & TS_TASK_TYPE_MASK;
+}
+
+static inline uint8_t ts_irq_flag(const struct timestamp* ts)
+{
+	return (ts->flags >> TS_IRQ_FLAG_SHIFT) & TS_IRQ_FLAG_MASK;
+}
+
+static inline uint8_t ts_irq_count(const struct timestamp* ts)
+{
+	return (ts->flags >> TS_IRQ_COUNT_SHIFT) & TS_IRQ_COUNT_MASK;
+}
+
+/* Batch decoding of records into column arrays (e.g., to filter on a field
+ * with vector instructions). Columns that are NULL are not decoded; each
+ * column is decoded in a separate loop, which the compiler vectorizes. */
+struct ts_columns {
+	uint64_t*	timestamp;
+	uint16_t*	pid;
+	uint32_t*	seq_no;
+	uint8_t*	cpu;
+	uint8_t*	event;
+	uint8_t*	task_type;
+	uint8_t*	irq_flag;
+	uint8_t*	irq_count;
+};
+
+void ts_unpack(const struct timestamp* ts, size_t count,
+	       const struct ts_columns* cols);
+
 typedef uint32_t cmd_t;
 
 int  str2event(const char* str, cmd_t *id);
@@ -0,0 +1,87 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "columns.h"
+
+struct column_layout {
+	const char* name;
+	char        type;
+	size_t      size;
+	size_t      offset;
+};
+
+#define COLUMN(field, type) \
+	{#field, type, sizeof(((struct sample_row*) 0)->field), \
+	 offsetof(struct sample_row, field)}
+
+static struct column_layout layout[NR_SAMPLE_COLUMNS] = {
+	COLUMN(start, 'u'),
+	COLUMN(end, 'u'),
+	COLUMN(exec, 'u'),
+	COLUMN(seq_no, 'u'),
+	COLUMN(pid, 'u'),
+	COLUMN(cpu, 'u'),
+	COLUMN(irq_count, 'u'),
+};
+
+static char byte_order(void)
+{
+	uint16_t probe = 1;
+
+	return *((uint8_t*) &probe) ? '<' : '>';
+}
+
+int write_columns(int rows, struct outbuf* out)
+{
+	struct column_header hdr;
+	struct stat info;
+	struct sample_row* row = NULL;
+	uint64_t nr_rows, i;
+	uint64_t offset = sizeof(hdr);
+	char* buf;
+	int c;
+
+	if (fstat(rows, &info))
+		return -1;
+	nr_rows = info.st_size / sizeof(struct sample_row);
+	if (nr_rows) {
+		row = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE,
+			   rows, 0);
+		if (row == MAP_FAILED)
+			return -1;
+		madvise(row, info.st_size, MADV_WILLNEED);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, COLUMNS_MAGIC, sizeof(hdr.magic));
+	hdr.version    = COLUMNS_VERSION;
+	hdr.nr_columns = NR_SAMPLE_COLUMNS;
+	hdr.nr_rows    = nr_rows;
+	for (c = 0; c < NR_SAMPLE_COLUMNS; c++) {
+		snprintf(hdr.columns[c].name, sizeof(hdr.columns[c].name),
+			 "%s", layout[c].name);
+		snprintf(hdr.columns[c].dtype, sizeof(hdr.columns[c].dtype),
+			 "%c%c%u", byte_order(), layout[c].type,
+			 (unsigned int) layout[c].size);
+		hdr.columns[c].offset = offset;
+		offset += nr_rows * layout[c].size;
+	}
+	outbuf_write(out, &hdr, sizeof(hdr));
+
+	/* gather one column at a time */
+	for (c = 0; c < NR_SAMPLE_COLUMNS; c++)
+		for (i = 0; i < nr_rows; i++) {
+			buf = outbuf_reserve(out, layout[c].size);
+			memcpy(buf, (char*) (row + i) + layout[c].offset,
+			       layout[c].size);
+			out->fill += layout[c].size;
+		}
+
+	if (row)
+		munmap(row, info.st_size);
+	return out->error ? -1 : 0;
+}
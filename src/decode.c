@@ -0,0 +1,341 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "decode.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	defined(TS_LAYOUT_LSB_FIRST)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#define FLAGS_OFFSET 14
+
+/* the shuffle depends on the record layout */
+typedef char check_record_layout[
+	offsetof(struct timestamp, seq_no) == 8 &&
+	offsetof(struct timestamp, event) == 13 &&
+	offsetof(struct timestamp, flags) == FLAGS_OFFSET &&
+	sizeof(struct timestamp) == 16 ? 1 : -1];
+
+/* Where each byte of a converted Feather-Trace record comes from. The first
+ * word holds the 48-bit timestamp and the 16-bit PID, in opposite halves in
+ * either byte order, so it is reversed in two pieces. */
+static const uint8_t record_shuffle[16] = {
+	5, 4, 3, 2, 1, 0, 7, 6,
+	11, 10, 9, 8,
+	12, 13, FLAGS_OFFSET, 15,
+};
+
+/* converted task_type/irq_flag/irq_count byte */
+static uint8_t flags_table[256];
+
+static int host_is_big_endian(void)
+{
+	uint16_t one = 1;
+
+	return *(uint8_t*) &one == 0;
+}
+
+int parse_trace_order(const char* str, enum trace_order* order)
+{
+	if (!strcmp(str, "auto"))
+		*order = TRACE_AUTO;
+	else if (!strcmp(str, "native"))
+		*order = TRACE_NATIVE;
+	else if (!strcmp(str, "swapped"))
+		*order = TRACE_SWAPPED;
+	else
+		return -1;
+	return 0;
+}
+
+/* A foreign flags byte has the fields in the other layout. */
+static void init_flags_table(void)
+{
+	unsigned int f;
+
+	for (f = 0; f < 256; f++)
+#ifdef TS_LAYOUT_MSB_FIRST
+		flags_table[f] = TS_FLAGS(f, f >> 2, f >> 3);
+#else
+		flags_table[f] = TS_FLAGS(f >> 6, f >> 5, f);
+#endif
+}
+
+static void swap_scalar(struct timestamp* ts, size_t count)
+{
+	uint8_t in[16], *out;
+	size_t i;
+	int b;
+
+	for (i = 0; i < count; i++) {
+		out = (uint8_t*) (ts + i);
+		memcpy(in, out, sizeof(in));
+		for (b = 0; b < 16; b++)
+			out[b] = in[record_shuffle[b]];
+		out[FLAGS_OFFSET] = flags_table[in[FLAGS_OFFSET]];
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* x86 is little-endian, so the flags come from a big-endian layout: per byte,
+ * task_type moves from bits 7-6 to bits 1-0, irq_flag from bit 5 to bit 2,
+ * and irq_count from bits 4-0 to bits 7-3. Bits that the 16-bit shifts carry
+ * across bytes are masked off. */
+__attribute__((target("ssse3")))
+static __m128i convert_flags_sse(__m128i x)
+{
+	__m128i tt  = _mm_and_si128(_mm_srli_epi16(x, 6), _mm_set1_epi8(0x03));
+	__m128i irq = _mm_and_si128(_mm_srli_epi16(x, 3), _mm_set1_epi8(0x04));
+	__m128i cnt = _mm_and_si128(_mm_slli_epi16(x, 3),
+				    _mm_set1_epi8((char) 0xf8));
+
+	return _mm_or_si128(_mm_or_si128(tt, irq), cnt);
+}
+
+__attribute__((target("ssse3")))
+static void swap_ssse3(struct timestamp* ts, size_t count)
+{
+	const __m128i shuffle = _mm_loadu_si128((const __m128i*) record_shuffle);
+	const __m128i flags = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0,
+					    0, 0, 0, 0, 0, 0, -1, 0);
+	__m128i x;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		x = _mm_loadu_si128((__m128i*) (ts + i));
+		x = _mm_shuffle_epi8(x, shuffle);
+		x = _mm_or_si128(_mm_andnot_si128(flags, x),
+				 _mm_and_si128(flags, convert_flags_sse(x)));
+		_mm_storeu_si128((__m128i*) (ts + i), x);
+	}
+}
+
+__attribute__((target("avx2")))
+static __m256i convert_flags_avx2(__m256i x)
+{
+	__m256i tt  = _mm256_and_si256(_mm256_srli_epi16(x, 6),
+				       _mm256_set1_epi8(0x03));
+	__m256i irq = _mm256_and_si256(_mm256_srli_epi16(x, 3),
+				       _mm256_set1_epi8(0x04));
+	__m256i cnt = _mm256_and_si256(_mm256_slli_epi16(x, 3),
+				       _mm256_set1_epi8((char) 0xf8));
+
+	return _mm256_or_si256(_mm256_or_si256(tt, irq), cnt);
+}
+
+/* Two records per 32-byte load: the shuffle stays within 16-byte lanes. */
+__attribute__((target("avx2")))
+static void swap_avx2(struct timestamp* ts, size_t count)
+{
+	const __m256i shuffle = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) record_shuffle));
+	const __m256i flags = _mm256_setr_epi8(
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1, 0);
+	__m256i x, y;
+	size_t i;
+
+	for (i = 0; i + 4 <= count; i += 4) {
+		x = _mm256_loadu_si256((__m256i*) (ts + i));
+		y = _mm256_loadu_si256((__m256i*) (ts + i + 2));
+		x = _mm256_shuffle_epi8(x, shuffle);
+		y = _mm256_shuffle_epi8(y, shuffle);
+		x = _mm256_or_si256(_mm256_andnot_si256(flags, x),
+				    _mm256_and_si256(flags,
+						     convert_flags_avx2(x)));
+		y = _mm256_or_si256(_mm256_andnot_si256(flags, y),
+				    _mm256_and_si256(flags,
+						     convert_flags_avx2(y)));
+		_mm256_storeu_si256((__m256i*) (ts + i), x);
+		_mm256_storeu_si256((__m256i*) (ts + i + 2), y);
+	}
+	swap_scalar(ts + i, count - i);
+}
+
+#endif
+
+static void (*kernel)(struct timestamp* ts, size_t count);
+static const char* kernel_name;
+
+static void select_kernel(void)
+{
+	init_flags_table();
+
+	kernel = swap_scalar;
+	kernel_name = "scalar";
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernel = swap_avx2;
+		kernel_name = "avx2";
+	} else if (__builtin_cpu_supports("ssse3")) {
+		kernel = swap_ssse3;
+		kernel_name = "ssse3";
+	}
+#endif
+}
+
+void ft_swap(struct timestamp* ts, size_t count)
+{
+	if (!kernel)
+		select_kernel();
+	kernel(ts, count);
+}
+
+const char* ft_swap_kernel(void)
+{
+	if (!kernel)
+		select_kernel();
+	return kernel_name;
+}
+
+/* within 1024 of each other, modulo 2^32 */
+static int close_seq_no(uint32_t a, uint32_t b)
+{
+	return (uint32_t) (b - a + 1024) < 2048;
+}
+
+int ft_looks_swapped(const struct timestamp* ts, size_t count)
+{
+	size_t i, native = 0, swapped = 0;
+	uint32_t a, b;
+
+	if (count > DETECT_RECORDS)
+		count = DETECT_RECORDS;
+	for (i = 1; i < count; i++) {
+		a = ts[i - 1].seq_no;
+		b = ts[i].seq_no;
+		native  += close_seq_no(a, b);
+		swapped += close_seq_no(__builtin_bswap32(a),
+					__builtin_bswap32(b));
+	}
+	return swapped > native;
+}
+
+int ft_needs_swap(const struct timestamp* ts, size_t count,
+		  enum trace_order order)
+{
+	if (order == TRACE_AUTO)
+		return ft_looks_swapped(ts, count);
+	return order == TRACE_SWAPPED;
+}
+
+int ft_decode(struct timestamp* ts, size_t count, enum trace_order order)
+{
+	if (!ft_needs_swap(ts, count, order))
+		return 0;
+	ft_swap(ts, count);
+	return 1;
+}
+
+#define SMALL_JOB  (1u << 24)
+#define SMALL_TIME (1ull << 56)
+
+static int has_time(const struct st_event_record* rec)
+{
+	return rec->hdr.type > ST_PARAM && rec->hdr.type < ST_INVALID;
+}
+
+int st_looks_swapped(const struct st_event_record* rec, size_t count)
+{
+	size_t i, native = 0, swapped = 0;
+	uint64_t when;
+	uint32_t job;
+
+	if (count > DETECT_RECORDS)
+		count = DETECT_RECORDS;
+	for (i = 0; i < count; i++) {
+		if (!rec[i].hdr.type || rec[i].hdr.type >= ST_INVALID)
+			continue;
+		job = rec[i].hdr.job;
+		native  += job < SMALL_JOB;
+		swapped += __builtin_bswap32(job) < SMALL_JOB;
+		if (has_time(rec + i)) {
+			when = rec[i].data.raw[0];
+			native  += when < SMALL_TIME;
+			swapped += __builtin_bswap64(when) < SMALL_TIME;
+		}
+	}
+	return swapped > native;
+}
+
+/* forced:1 and exec_time:63 share the second word */
+static void swap_completion(struct st_event_record* rec)
+{
+	uint64_t word = __builtin_bswap64(rec->data.raw[1]);
+
+	rec->data.raw[0] = __builtin_bswap64(rec->data.raw[0]);
+	rec->data.raw[1] = 0;
+	if (host_is_big_endian()) {
+		rec->data.completion.forced    = word & 0x1;
+		rec->data.completion.exec_time = word >> 1;
+	} else {
+		rec->data.completion.forced    = word >> 63;
+		rec->data.completion.exec_time = word & ~(1ull << 63);
+	}
+}
+
+static uint32_t swap32(uint32_t x)
+{
+	return __builtin_bswap32(x);
+}
+
+void st_swap(struct st_event_record* rec, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++, rec++) {
+		rec->hdr.pid = __builtin_bswap16(rec->hdr.pid);
+		rec->hdr.job = __builtin_bswap32(rec->hdr.job);
+		switch (rec->hdr.type) {
+		case ST_NAME:
+			break;
+		case ST_PARAM:
+			rec->data.param.wcet   = swap32(rec->data.param.wcet);
+			rec->data.param.period = swap32(rec->data.param.period);
+			rec->data.param.phase  = swap32(rec->data.param.phase);
+			break;
+		case ST_COMPLETION:
+			swap_completion(rec);
+			break;
+		case ST_SWITCH_TO:
+			rec->data.raw[0] = __builtin_bswap64(rec->data.raw[0]);
+			rec->data.switch_to.exec_time =
+				swap32(rec->data.switch_to.exec_time);
+			break;
+		case ST_ASSIGNED:
+		case ST_ACTION:
+			/* followed by single bytes */
+			rec->data.raw[0] = __builtin_bswap64(rec->data.raw[0]);
+			break;
+		case ST_RELEASE:
+		case ST_SWITCH_AWAY:
+		case ST_BLOCK:
+		case ST_RESUME:
+		case ST_SYS_RELEASE:
+		case ST_NP_ENTER:
+		case ST_NP_EXIT:
+			rec->data.raw[0] = __builtin_bswap64(rec->data.raw[0]);
+			rec->data.raw[1] = __builtin_bswap64(rec->data.raw[1]);
+			break;
+		default:
+			/* unknown layout */
+			break;
+		}
+	}
+}
+
+int st_decode(struct st_event_record* rec, size_t count,
+	      enum trace_order order)
+{
+	if (order == TRACE_AUTO)
+		order = st_looks_swapped(rec, count) ? TRACE_SWAPPED :
+			TRACE_NATIVE;
+	if (order != TRACE_SWAPPED)
+		return 0;
+	st_swap(rec, count);
+	return 1;
+}
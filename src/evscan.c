@@ -0,0 +1,194 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "evscan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#define EVENT_OFFSET 13
+
+/* the vector kernels depend on the record layout */
+typedef char check_event_offset[
+	offsetof(struct timestamp, event) == EVENT_OFFSET &&
+	sizeof(struct timestamp) == 16 ? 1 : -1];
+
+/* Shuffle masks that move the event ID of the i-th record of a 16-byte
+ * (SSSE3) or of each 16-byte lane of a 32-byte load (AVX2) to byte i. */
+static uint8_t gather_masks[16][32];
+
+void event_set_init(struct event_set* set)
+{
+	memset(set, 0, sizeof(*set));
+}
+
+void event_set_add(struct event_set* set, uint8_t id)
+{
+	set->member[id] = 1;
+	set->nibble_bits[id >> 7][id & 0xf] |= 1 << ((id >> 4) & 7);
+}
+
+void event_set_remove(struct event_set* set, uint8_t id)
+{
+	set->member[id] = 0;
+	set->nibble_bits[id >> 7][id & 0xf] &= ~(1 << ((id >> 4) & 7));
+}
+
+static struct timestamp* find_event_scalar(struct timestamp* start,
+					   struct timestamp* end,
+					   const struct event_set* set)
+{
+	while (start < end && !set->member[start->event])
+		start++;
+	return start;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* Bit i of the result is set if byte i of events is a member of the set:
+ * the low nibble selects a byte of the set's bitmaps, the high nibble
+ * selects the bitmap and a bit in it. */
+__attribute__((target("ssse3")))
+static int classify_sse(__m128i events, __m128i lo_bits, __m128i hi_bits)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i bit = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+					  1, 2, 4, 8, 16, 32, 64, -128);
+	__m128i lo  = _mm_and_si128(events, nibble);
+	__m128i hi  = _mm_and_si128(_mm_srli_epi16(events, 4), nibble);
+	__m128i a   = _mm_shuffle_epi8(lo_bits, lo);
+	__m128i b   = _mm_shuffle_epi8(hi_bits, lo);
+	__m128i sel = _mm_cmpgt_epi8(hi, _mm_set1_epi8(7));
+	__m128i row = _mm_or_si128(_mm_andnot_si128(sel, a),
+				   _mm_and_si128(sel, b));
+	__m128i hit = _mm_and_si128(row, _mm_shuffle_epi8(bit, hi));
+
+	return ~_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128()))
+		& 0xffff;
+}
+
+__attribute__((target("ssse3")))
+static struct timestamp* find_event_ssse3(struct timestamp* start,
+					  struct timestamp* end,
+					  const struct event_set* set)
+{
+	__m128i lo_bits = _mm_loadu_si128((const __m128i*) set->nibble_bits[0]);
+	__m128i hi_bits = _mm_loadu_si128((const __m128i*) set->nibble_bits[1]);
+	__m128i gather[16];
+	__m128i events;
+	int i, hits;
+
+	for (i = 0; i < 16; i++)
+		gather[i] = _mm_loadu_si128((const __m128i*) gather_masks[i]);
+
+	for (; end - start >= 16; start += 16) {
+		events = _mm_setzero_si128();
+		for (i = 0; i < 16; i++)
+			events = _mm_or_si128(events, _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i*) (start + i)),
+				gather[i]));
+		hits = classify_sse(events, lo_bits, hi_bits);
+		if (hits)
+			return start + __builtin_ctz(hits);
+	}
+	return find_event_scalar(start, end, set);
+}
+
+__attribute__((target("avx2")))
+static struct timestamp* find_event_avx2(struct timestamp* start,
+					 struct timestamp* end,
+					 const struct event_set* set)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	const __m256i bit = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+					     1, 2, 4, 8, 16, 32, 64, -128,
+					     1, 2, 4, 8, 16, 32, 64, -128,
+					     1, 2, 4, 8, 16, 32, 64, -128);
+	__m256i lo_bits = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) set->nibble_bits[0]));
+	__m256i hi_bits = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i*) set->nibble_bits[1]));
+	__m256i gather[16];
+	__m256i events, lo, hi, row, sel, hit;
+	unsigned int hits, even, odd, first_even, first_odd;
+	int i;
+
+	/* Each 32-byte load covers two records, one per lane. */
+	for (i = 0; i < 16; i++)
+		gather[i] = _mm256_loadu_si256((const __m256i*) gather_masks[i]);
+
+	for (; end - start >= 32; start += 32) {
+		events = _mm256_setzero_si256();
+		for (i = 0; i < 16; i++)
+			events = _mm256_or_si256(events, _mm256_shuffle_epi8(
+				_mm256_loadu_si256(
+					(const __m256i*) (start + 2 * i)),
+				gather[i]));
+
+		lo  = _mm256_and_si256(events, nibble);
+		hi  = _mm256_and_si256(_mm256_srli_epi16(events, 4), nibble);
+		sel = _mm256_cmpgt_epi8(hi, _mm256_set1_epi8(7));
+		row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo_bits, lo),
+					 _mm256_shuffle_epi8(hi_bits, lo), sel);
+		hit = _mm256_and_si256(row, _mm256_shuffle_epi8(bit, hi));
+		hits = ~_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(hit, _mm256_setzero_si256()));
+		if (hits) {
+			/* low lane: even records, high lane: odd records */
+			even = hits & 0xffff;
+			odd  = hits >> 16;
+			first_even = even ? 2 * __builtin_ctz(even) : 32;
+			first_odd  = odd ? 2 * __builtin_ctz(odd) + 1 : 32;
+			return start + (first_even < first_odd ?
+					first_even : first_odd);
+		}
+	}
+	return find_event_ssse3(start, end, set);
+}
+
+#endif
+
+typedef struct timestamp* (*find_event_t)(struct timestamp*, struct timestamp*,
+					  const struct event_set*);
+
+static find_event_t kernel = NULL;
+static const char* kernel_name;
+
+static void select_kernel(void)
+{
+	int i;
+
+	memset(gather_masks, 0x80, sizeof(gather_masks));
+	for (i = 0; i < 16; i++)
+		gather_masks[i][i] = gather_masks[i][16 + i] = EVENT_OFFSET;
+
+	kernel = find_event_scalar;
+	kernel_name = "scalar";
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		kernel = find_event_avx2;
+		kernel_name = "avx2";
+	} else if (__builtin_cpu_supports("ssse3")) {
+		kernel = find_event_ssse3;
+		kernel_name = "ssse3";
+	}
+#endif
+}
+
+struct timestamp* find_event(struct timestamp* start, struct timestamp* end,
+			     const struct event_set* set)
+{
+	if (!kernel)
+		select_kernel();
+	return kernel(start, end, set);
+}
+
+const char* find_event_kernel(void)
+{
+	if (!kernel)
+		select_kernel();
+	return kernel_name;
+}
@@ -18,17 +18,31 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <fcntl.h>
 
 #include "mapping.h"
+#include "columns.h"
+#include "outbuf.h"
+#include "samples.h"
+#include "reorder.h"
+#include "histogram.h"
+#include "evscan.h"
+#include "decode.h"
+#include "segments.h"
 
 #include "timestamp.h"
 
 #define AUTO_SELECT -1
 
+#define MAX_CPUS (UINT8_MAX + 1)
+#define MAX_PIDS (UINT16_MAX + 1)
+
 static int want_interleaved    = 1;
 static int want_best_effort    = 0;
 static int want_interrupted    = 0;
@@ -40,368 +54,1394 @@ static int avoid_cpu = -1;
 /* only use samples from a specific CPU */
 static int only_cpu  = -1;
 
-static unsigned int complete   = 0;
-static unsigned int incomplete = 0;
-static unsigned int interrupted = 0;
-static unsigned int skipped    = 0;
-static unsigned int non_rt     = 0;
-static unsigned int interleaved = 0;
-static unsigned int avoided    = 0;
+struct pending;
+struct window;
+
+/* per-event-type extraction state */
+struct event_ctx {
+	cmd_t id;
+	const char* name;
+	int find_by_pid;
+	int want_best_effort;
+	int want_interrupted;
+
+	/* where the samples go */
+	struct outbuf* out;
+	struct outbuf* cpu_out[MAX_CPUS];
+	char* target;
+
+	/* Unresolved and not-yet-written pairs, in the order of their start
+	 * records. Samples are written strictly in this order. */
+	struct pending* fifo_head;
+	struct pending* fifo_tail;
+
+	/* first end record seen yet? */
+	int seen_end;
+
+	/* Time-windowed statistics: the current window of each CPU, and, in
+	 * clones, all windows in the order in which they were opened. */
+	struct window* window[MAX_CPUS];
+	struct window* windows_head;
+	struct window* windows_tail;
+
+	/* summary statistics (-S), per CPU if split by CPU */
+	struct histogram* summary[MAX_CPUS];
+
+	/* Parallel matching: samples are collected in memory, and pairs that
+	 * start before the chunk's first end record are accounted to pre,
+	 * since they count only if an earlier chunk saw an end record. */
+	int in_memory;
+	struct event_ctx* pre;
+
+	unsigned int complete;
+	unsigned int incomplete;
+	unsigned int interrupted;
+	unsigned int skipped;
+	unsigned int non_rt;
+	unsigned int interleaved;
+	unsigned int avoided;
+};
+
+static int split_by_cpu = 0;
+
+static const char* output_ext = "csv";
+
+/* Spooled output formats: samples are collected in a temporary file, which is
+ * converted by spool_writer when the output is closed. The result is written
+ * to the destination opened with spool_flags. */
+typedef int (*spool_writer_t)(int spool, struct outbuf* out);
+static spool_writer_t spool_writer = NULL;
+static int spool_flags;
+
+/* the final destination of a sample stream: a per-event file in multi-event
+ * mode, stdout otherwise */
+static int open_dest(struct event_ctx* ev, uint8_t cpu, int flags)
+{
+	char fname[4096];
+	int fd;
+
+	if (!ev->target)
+		return STDOUT_FILENO;
+	if (split_by_cpu)
+		snprintf(fname, sizeof(fname), "%s_core=%u.%s",
+			 ev->target, cpu, output_ext);
+	else
+		snprintf(fname, sizeof(fname), "%s.%s",
+			 ev->target, output_ext);
+	fd = open(fname, O_WRONLY | O_CREAT | flags, 0666);
+	if (fd < 0) {
+		perror(fname);
+		exit(1);
+	}
+	return fd;
+}
 
-static struct timestamp* next(struct timestamp* first, struct timestamp* end,
-			      int cpu)
+/* an unlinked temporary file */
+static int open_spool(void)
 {
-	struct timestamp* pos;
-	uint32_t last_seqno = 0, next_seqno = 0;
+	FILE* f = tmpfile();
+	int fd;
 
+	if (!f || (fd = dup(fileno(f))) < 0) {
+		perror("tmpfile");
+		exit(1);
+	}
+	fclose(f);
+	return fd;
+}
 
-	last_seqno = first->seq_no;
-	for (pos = first + 1; pos < end;  pos++) {
-		/* check for for holes in the sequence number */
-		next_seqno = last_seqno + 1;
-		if (next_seqno != pos->seq_no) {
-			/* stumbled across a hole */
-			return NULL;
-		}
-		last_seqno = pos->seq_no;
+static struct outbuf* open_output(struct event_ctx* ev, uint8_t cpu)
+{
+	struct outbuf* ob = malloc(sizeof(*ob));
 
-		if (pos->cpu == cpu)
-			return pos;
+	if (!ob) {
+		perror("malloc");
+		exit(1);
 	}
-	return NULL;
+	if (ev->in_memory)
+		outbuf_init(ob, -1);
+	else if (spool_writer)
+		outbuf_init(ob, open_spool());
+	else
+		outbuf_init(ob, open_dest(ev, cpu, O_APPEND));
+	return ob;
 }
 
-static struct timestamp* next_id(struct timestamp* start, struct timestamp* end,
-				 int cpu, unsigned long id,
-				 unsigned long stop_id,
-				 int *interrupt_flag)
+static void close_output(struct event_ctx* ev, uint8_t cpu, struct outbuf* ob)
 {
-	struct timestamp* pos = start;
-	int restarts = 0;
+	struct outbuf dest;
+
+	if (outbuf_release(ob))
+		fprintf(stderr, "Writing samples failed: %s\n",
+			strerror(ob->error));
+	if (!ev->in_memory && spool_writer) {
+		outbuf_init(&dest, open_dest(ev, cpu, spool_flags));
+		spool_writer(ob->fd, &dest);
+		if (outbuf_release(&dest))
+			fprintf(stderr, "Writing samples failed: %s\n",
+				strerror(dest.error));
+		close(ob->fd);
+		ob->fd = dest.fd;
+	}
+	if (ob->fd >= 0 && ob->fd != STDOUT_FILENO)
+		close(ob->fd);
+	free(ob);
+}
 
-	while ((pos = next(pos, end, cpu))) {
-		if (pos->event == id)
-			break;
-		else if (pos->event == stop_id)
-			return NULL;
+static void close_outputs(struct event_ctx* ev)
+{
+	int i;
 
-		restarts++;
-		if (!want_interleaved)
-			return NULL;
-		if (pos->irq_flag && !want_interrupted) {
-			*interrupt_flag = 1;
-			return NULL;
-		}
+	if (ev->out)
+		close_output(ev, 0, ev->out);
+	for (i = 0; i < MAX_CPUS; i++)
+		if (ev->cpu_out[i])
+			close_output(ev, i, ev->cpu_out[i]);
+}
+
+static struct outbuf* output_for(struct event_ctx* ev, uint8_t cpu)
+{
+	if (!split_by_cpu) {
+		if (!ev->out)
+			ev->out = open_output(ev, 0);
+		return ev->out;
 	}
-	if (pos)
-		interleaved += restarts;
 
-	if (pos && pos->irq_flag) {
-		interrupted++;
-		if (!want_interrupted) {
-			*interrupt_flag = 1;
-			return NULL;
-		}
+	if (!ev->cpu_out[cpu])
+		ev->cpu_out[cpu] = open_output(ev, cpu);
+	return ev->cpu_out[cpu];
+}
+
+typedef void (*pair_fmt_t)(struct outbuf* out, struct timestamp* first,
+			   struct timestamp* second, uint64_t exec_time);
+
+/* same as printf("%llu, %llu, %llu\n", ...) */
+static void print_pair_csv(struct outbuf* out, struct timestamp* first,
+			   struct timestamp* second, uint64_t exec_time)
+{
+	outbuf_put_u64(out, ts_timestamp(first));
+	outbuf_write(out, ", ", 2);
+	outbuf_put_u64(out, ts_timestamp(second));
+	outbuf_write(out, ", ", 2);
+	outbuf_put_u64(out, exec_time);
+	outbuf_write(out, "\n", 1);
+}
+
+static void print_pair_bin(struct outbuf* out, struct timestamp* first,
+			   struct timestamp* second, uint64_t exec_time)
+{
+	float delta =  exec_time;
+	outbuf_write(out, &delta, sizeof(delta));
+}
+
+static void print_pair_cols(struct outbuf* out, struct timestamp* first,
+			    struct timestamp* second, uint64_t exec_time)
+{
+	struct sample_row row;
+
+	row.start     = ts_timestamp(first);
+	row.end       = ts_timestamp(second);
+	row.exec      = exec_time;
+	row.seq_no    = first->seq_no;
+	row.pid       = ts_pid(first);
+	row.cpu       = first->cpu;
+	row.irq_count = ts_irq_count(second);
+	outbuf_write(out, &row, sizeof(row));
+}
+
+static void print_pair_raw(struct outbuf* out, struct timestamp* first,
+			   struct timestamp* second, uint64_t exec_time)
+{
+	outbuf_write(out, &exec_time, sizeof(exec_time));
+}
+
+pair_fmt_t format_pair = print_pair_csv;
+
+typedef void (*single_fmt_t)(struct outbuf* out, struct timestamp* ts);
+
+/* same as printf("0, 0, %llu\n", ...) */
+static void print_single_csv(struct outbuf* out, struct timestamp* ts)
+{
+	outbuf_write(out, "0, 0, ", 6);
+	outbuf_put_u64(out, ts_timestamp(ts));
+	outbuf_write(out, "\n", 1);
+}
+
+static void print_single_bin(struct outbuf* out, struct timestamp* ts)
+{
+	float delta = ts_timestamp(ts);
+
+	outbuf_write(out, &delta, sizeof(delta));
+}
+
+static void print_single_raw(struct outbuf* out, struct timestamp* ts)
+{
+	uint64_t val = ts_timestamp(ts);
+
+	outbuf_write(out, &val, sizeof(val));
+}
+
+static void print_single_cols(struct outbuf* out, struct timestamp* ts)
+{
+	struct sample_row row;
+
+	row.start     = 0;
+	row.end       = 0;
+	row.exec      = ts_timestamp(ts);
+	row.seq_no    = ts->seq_no;
+	row.pid       = ts_pid(ts);
+	row.cpu       = ts->cpu;
+	row.irq_count = ts_irq_count(ts);
+	outbuf_write(out, &row, sizeof(row));
+}
+
+single_fmt_t single_fmt = print_single_csv;
+
+/* Time-windowed statistics (-w).
+ *
+ * Instead of the samples themselves, one row of statistics is written for
+ * each window of window_length cycles and each CPU, bucketed by the time of
+ * the pair's start record. A window is written as soon as a sample of a later
+ * window arrives on the same CPU, so only one window per CPU is kept in
+ * memory. Samples whose start record precedes the CPU's current window (due
+ * to non-monotonic time stamps) are accounted to the current window.
+ */
+
+static uint64_t window_length = 0;
+
+/* resolution of the histograms used for windows and summaries */
+static unsigned int histogram_sub_bits = DEFAULT_HISTOGRAM_SUB_BITS;
+
+struct window {
+	uint64_t index;
+	uint8_t  cpu;
+	struct histogram hist;
+	struct window* next;
+};
+
+static void write_window(struct event_ctx* ev, struct window* w)
+{
+	struct histogram* h = &w->hist;
+	char row[256];
+	int len;
+
+	len = snprintf(row, sizeof(row),
+		       "%llu, %u, %llu, %llu, %llu, %llu, %llu, %.2f, %llu, %llu\n",
+		       (unsigned long long) (w->index * window_length),
+		       w->cpu,
+		       (unsigned long long) h->count,
+		       (unsigned long long) h->max,
+		       (unsigned long long) histogram_percentile(h, 99.9),
+		       (unsigned long long) histogram_percentile(h, 99.0),
+		       (unsigned long long) histogram_percentile(h, 95.0),
+		       histogram_mean(h),
+		       (unsigned long long) histogram_percentile(h, 50.0),
+		       (unsigned long long) h->min);
+	outbuf_write(output_for(ev, w->cpu), row, len);
+}
+
+static void free_window(struct window* w)
+{
+	free_histogram(&w->hist);
+	free(w);
+}
+
+/* Make a new window the current one of its CPU. The previous one is complete
+ * and written, unless the samples are collected for a later merge. */
+static struct window* open_window(struct event_ctx* ev, uint64_t index,
+				  uint8_t cpu)
+{
+	struct window* w = malloc(sizeof(*w));
+
+	if (!w) {
+		perror("malloc");
+		exit(1);
+	}
+	w->index = index;
+	w->cpu   = cpu;
+	w->next  = NULL;
+	init_histogram(&w->hist, histogram_sub_bits);
+
+	if (ev->in_memory) {
+		if (ev->windows_tail)
+			ev->windows_tail->next = w;
+		else
+			ev->windows_head = w;
+		ev->windows_tail = w;
+	} else if (ev->window[cpu]) {
+		write_window(ev, ev->window[cpu]);
+		free_window(ev->window[cpu]);
 	}
+	ev->window[cpu] = w;
+	return w;
+}
+
+static struct window* window_for(struct event_ctx* ev, uint64_t index,
+				 uint8_t cpu)
+{
+	struct window* w = ev->window[cpu];
 
-	return pos;
+	if (!w || index > w->index)
+		w = open_window(ev, index, cpu);
+	return w;
 }
 
-static struct timestamp* find_second_ts(struct timestamp* start,
-					struct timestamp* end,
-					int *interrupt_flag)
+static void add_to_window(struct event_ctx* ev, struct timestamp* first,
+			  uint64_t exec_time)
 {
-	/* convention: the end->event is start->event + 1 */
-	return next_id(start, end, start->cpu, start->event + 1,
-		       start->event, interrupt_flag);
+	struct window* w;
+
+	w = window_for(ev, ts_timestamp(first) / window_length, first->cpu);
+	histogram_add(&w->hist, exec_time);
 }
 
-static struct timestamp* next_pid(struct timestamp* first, struct timestamp* end,
-				  unsigned long id1, unsigned long id2,
-				  int interrupts_significant, int *interrupted_flag)
+/* Account the windows of a clone to ev, as if its samples had been added
+ * one by one. */
+static void merge_windows(struct event_ctx* ev, struct event_ctx* part)
 {
-	struct timestamp* pos;
-	uint32_t last_seqno = 0, next_seqno = 0;
-	int event_count = 0;
+	struct window *w, *next;
 
+	for (w = part->windows_head; w; w = next) {
+		next = w->next;
+		histogram_merge(&window_for(ev, w->index, w->cpu)->hist,
+				&w->hist);
+		free_window(w);
+	}
+	part->windows_head = part->windows_tail = NULL;
+	memset(part->window, 0, sizeof(part->window));
+}
 
-	last_seqno = first->seq_no;
-	for (pos = first + 1; pos < end;  pos++) {
-		event_count = event_count + 1;
-		/* check for for holes in the sequence number */
-		next_seqno = last_seqno + 1;
-		if (next_seqno != pos->seq_no) {
-			/* stumbled across a hole */
-			return NULL;
+/* write (or, in clones, discard) all remaining windows */
+static void close_windows(struct event_ctx* ev)
+{
+	struct window *w, *next;
+	int i;
+
+	if (ev->in_memory) {
+		for (w = ev->windows_head; w; w = next) {
+			next = w->next;
+			free_window(w);
 		}
-		last_seqno = pos->seq_no;
-
-		if (interrupts_significant
-		    && pos->cpu == first->cpu
-		    && pos->irq_flag) {
-			/* did an interrupt get in the way? */
-			interrupted++;
-			if (!want_interrupted) {
-				*interrupted_flag = 1;
-				return NULL;
+		ev->windows_head = ev->windows_tail = NULL;
+	} else
+		for (i = 0; i < MAX_CPUS; i++)
+			if (ev->window[i]) {
+				write_window(ev, ev->window[i]);
+				free_window(ev->window[i]);
 			}
-		}
+	memset(ev->window, 0, sizeof(ev->window));
+}
 
-		/* only care about this PID */
-		if (pos->pid == first->pid) {
-			/* is  it the right one? */
-			if (pos->event == id1 || pos->event == id2)
-				return pos;
-			else
-				if (event_count > max_interleaved_skipped)
-					/* Don't allow unexpected IDs interleaved.
-					 * Tasks are sequential, there shouldn't be
-					 * anything else. */
-					return NULL;
+/* Summary statistics (-S).
+ *
+ * Instead of writing the samples, a histogram is kept for each event (and
+ * CPU, if split by CPU), from which a summary row is printed at the end. The
+ * memory needed does not depend on the number of samples.
+ */
+
+static int summary_only = 0;
+
+static struct histogram* summary_for(struct event_ctx* ev, uint8_t cpu)
+{
+	int slot = split_by_cpu ? cpu : 0;
+
+	if (!ev->summary[slot]) {
+		ev->summary[slot] = malloc(sizeof(struct histogram));
+		if (!ev->summary[slot]) {
+			perror("malloc");
+			exit(1);
 		}
+		init_histogram(ev->summary[slot], histogram_sub_bits);
 	}
-	return NULL;
+	return ev->summary[slot];
 }
 
-static struct timestamp* skip_over_suspension(struct timestamp *pos,
-					      struct timestamp *end,
-					      uint64_t *last_time)
+static void merge_summaries(struct event_ctx* ev, struct event_ctx* part)
 {
-	/* Find matching resume. */
-	pos = next_pid(pos, end,
-		       TS_LOCK_RESUME, TS_SCHED_START,
-		       0, NULL);
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++)
+		if (part->summary[i]) {
+			histogram_merge(summary_for(ev, i), part->summary[i]);
+			free_histogram(part->summary[i]);
+			free(part->summary[i]);
+			part->summary[i] = NULL;
+		}
+}
 
-	if (!pos || pos->timestamp < *last_time)
-		/* broken stream */
-		return NULL;
+static void print_summary_header(void)
+{
+	printf("# Overhead, CPU, n, max, p99.9, p99, p95, avg, min\n");
+}
 
-	*last_time = pos->timestamp;
+static void print_summary_row(struct event_ctx* ev, const char* cpu,
+			      struct histogram* h)
+{
+	printf("%s, %s, %llu, %llu, %llu, %llu, %llu, %.2f, %llu\n",
+	       ev->name, cpu,
+	       (unsigned long long) h->count,
+	       (unsigned long long) h->max,
+	       (unsigned long long) histogram_percentile(h, 99.9),
+	       (unsigned long long) histogram_percentile(h, 99.0),
+	       (unsigned long long) histogram_percentile(h, 95.0),
+	       histogram_mean(h),
+	       (unsigned long long) h->min);
+}
 
-	if (pos->event == TS_SCHED_START) {
-		/* Was scheduled out, find TS_SCHED_END. */
-		pos = next_pid(pos, end, TS_SCHED_END, 0, 0, NULL);
-		if (!pos || pos->timestamp < *last_time)
-			return NULL;
+/* print (or, in clones, discard) the summary */
+static void close_summaries(struct event_ctx* ev)
+{
+	char cpu[8];
+	int i;
+
+	if (summary_only && !ev->in_memory && !split_by_cpu)
+		print_summary_row(ev, "*", summary_for(ev, 0));
+	for (i = 0; i < MAX_CPUS; i++)
+		if (ev->summary[i]) {
+			snprintf(cpu, sizeof(cpu), "%d", i);
+			if (!ev->in_memory && split_by_cpu)
+				print_summary_row(ev, cpu, ev->summary[i]);
+			free_histogram(ev->summary[i]);
+			free(ev->summary[i]);
+			ev->summary[i] = NULL;
+		}
+}
 
-		/* next find TS_LOCK_RESUME */
-		pos = next_pid(pos, end, TS_LOCK_RESUME, 0, 0, NULL);
-	}
+/* Pair matching.
+ *
+ * All pairs are matched in a single forward pass over the trace. Each start
+ * record opens a pending lookup that is advanced by every later record it
+ * could care about: in event ID mode by records on the same CPU, in PID mode
+ * by records of the same task (and, for interrupt detection, by records on
+ * the CPU of the last matched record). Pending lookups never extend across a
+ * hole in the sequence numbers. Each record thus only touches the lookups it
+ * can affect, no matter how many unrelated records are interleaved.
+ */
 
+struct link {
+	struct link *prev, *next;
+};
 
-	return pos;
+static void list_init(struct link* head)
+{
+	head->prev = head->next = head;
 }
 
-static struct timestamp* accumulate_exec_time(
-	struct timestamp* start, struct timestamp* end,
-	unsigned long stop_id, uint64_t *sum,
-	int *interrupted_flag)
+static void list_add(struct link* head, struct link* l)
 {
-	struct timestamp *pos = start;
-	uint64_t exec_start;
-	uint64_t last_time = start->timestamp;
+	l->prev = head->prev;
+	l->next = head;
+	head->prev->next = l;
+	head->prev = l;
+}
 
-	*sum = 0;
+static void list_del(struct link* l)
+{
+	if (l->next) {
+		l->prev->next = l->next;
+		l->next->prev = l->prev;
+		l->prev = l->next = NULL;
+	}
+}
 
-	while (1) {
-		exec_start = pos->timestamp;
+#define list_entry(ptr, type, member) \
+	((type*) ((char*) (ptr) - offsetof(type, member)))
+
+enum match_state {
+	/* event ID: next record on the same CPU */
+	MATCH_ID,
+	/* PID: the end record of the same task */
+	MATCH_PID,
+	/* PID, suspension-aware: a suspension or the end record */
+	MATCH_EXEC,
+	/* suspended: resume, or scheduler invocation */
+	MATCH_RESUME,
+	/* scheduled out while suspended: end of scheduler invocation */
+	MATCH_SCHED_END,
+	/* scheduled out while suspended: the resume */
+	MATCH_SCHED_RESUME,
+};
+
+enum match_outcome {
+	UNRESOLVED,
+	COMPLETE,
+	INCOMPLETE,
+	/* discarded due to an interrupt; counted neither way */
+	INTERRUPTED,
+	NON_RT,
+};
+
+struct pending {
+	struct event_ctx* ev;
+	struct timestamp first;
+	struct timestamp second;
+	uint64_t exec_time;
 
-		/* Find a suspension or the proper end. */
-		pos = next_pid(pos, end,
-			       TS_LOCK_SUSPEND, stop_id,
-			       1, interrupted_flag);
+	enum match_state state;
+	enum match_outcome outcome;
 
-		if (!pos || pos->timestamp < last_time)
-			/* broken stream */
-			return NULL;
+	/* position and CPU of the last matched record */
+	size_t anchor;
+	uint8_t anchor_cpu;
 
-		/* account for exec until pos */
-		*sum += pos->timestamp - exec_start;
+	/* event ID mode: records skipped on the same CPU */
+	unsigned int restarts;
 
-		if (pos->event == stop_id)
-			/* no suspension or preemption */
-			return pos;
-		else {
-			last_time = pos->timestamp;
+	/* suspension-aware mode */
+	uint64_t exec_start;
+	uint64_t last_time;
+
+	struct link by_key;   /* per-CPU (event ID) or per-PID list */
+	struct link by_irq;   /* per-CPU list of interrupt-sensitive lookups */
+	struct link active;
+	struct pending* fifo_next;
+};
+
+struct matcher {
+	struct link by_cpu[MAX_CPUS];
+	struct link irq_on_cpu[MAX_CPUS];
+	struct link* by_pid;
+	struct link active;
+
+	struct pending* free_list;
+
+	/* position of the current and sequence number of the previous record */
+	size_t pos;
+	uint32_t last_seqno;
+	int started;
+	/* records before this position are known to follow without a hole */
+	size_t hole_free_to;
+};
+
+static void init_matcher(struct matcher* m)
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		list_init(m->by_cpu + i);
+		list_init(m->irq_on_cpu + i);
+	}
+	m->by_pid = malloc(sizeof(struct link) * MAX_PIDS);
+	if (!m->by_pid) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < MAX_PIDS; i++)
+		list_init(m->by_pid + i);
+	list_init(&m->active);
+	m->free_list = NULL;
+	m->pos = 0;
+	m->hole_free_to = 0;
+}
 
-			/* handle self-suspension */
-			pos = skip_over_suspension(pos, end, &last_time);
+/* hole-free segments of the mapped trace (see ftsort -i), if known */
+static struct segment_index* segments;
 
-			/* Must be a resume => start over.  If a resume sample is
-			 * affected by interrupts we don't care since it does not
-			 * contribute to the reported execution cost.
-			 */
+/* Does the record at the current position follow the previous one without a
+ * hole? With a segment index, this is checked once per segment. */
+static int continues(struct matcher* m, struct timestamp* ts)
+{
+	if (m->pos < m->hole_free_to)
+		return 1;
+	if (segments)
+		m->hole_free_to = segment_end(segments, m->pos);
+	return !m->started || m->last_seqno + 1 == ts->seq_no;
+}
 
-			if (!pos || pos->timestamp < last_time)
-				/* broken stream */
-				return NULL;
+static struct pending* alloc_pending(struct matcher* m)
+{
+	struct pending* p = m->free_list;
 
-			last_time = pos->timestamp;
-		}
+	if (p)
+		m->free_list = p->fifo_next;
+	else if (!(p = malloc(sizeof(*p)))) {
+		perror("malloc");
+		exit(1);
 	}
+	memset(p, 0, sizeof(*p));
+	return p;
 }
 
-typedef void (*pair_fmt_t)(struct timestamp* first, struct timestamp* second, uint64_t exec_time);
+/* write out all resolved pairs at the head of the event's FIFO */
+static void flush_pairs(struct matcher* m, struct event_ctx* ev)
+{
+	struct pending* p;
+
+	while ((p = ev->fifo_head) && p->outcome != UNRESOLVED) {
+		if (p->outcome == COMPLETE && window_length)
+			add_to_window(ev, &p->first, p->exec_time);
+		else if (p->outcome == COMPLETE && summary_only)
+			histogram_add(summary_for(ev, p->first.cpu),
+				      p->exec_time);
+		else if (p->outcome == COMPLETE)
+			format_pair(output_for(ev, p->first.cpu),
+				    &p->first, &p->second, p->exec_time);
+		ev->fifo_head = p->fifo_next;
+		if (!ev->fifo_head)
+			ev->fifo_tail = NULL;
+		p->fifo_next = m->free_list;
+		m->free_list = p;
+	}
+}
 
-static void print_pair_csv(struct timestamp* first, struct timestamp* second, uint64_t exec_time)
+static void resolve(struct matcher* m, struct pending* p,
+		    enum match_outcome outcome)
 {
-	printf("%llu, %llu, %llu\n",
-	       (unsigned long long) first->timestamp,
-	       (unsigned long long) second->timestamp,
-	       (unsigned long long) exec_time);
+	struct event_ctx* ev = p->ev;
+
+	p->outcome = outcome;
+	switch (outcome) {
+	case COMPLETE:
+		ev->complete++;
+		break;
+	case INCOMPLETE:
+		ev->incomplete++;
+		break;
+	case NON_RT:
+		ev->non_rt++;
+		break;
+	default:
+		break;
+	}
+	list_del(&p->by_key);
+	list_del(&p->by_irq);
+	list_del(&p->active);
+	if (ev->fifo_head == p)
+		flush_pairs(m, ev);
 }
 
-static void print_pair_bin(struct timestamp* first, struct timestamp* second, uint64_t exec_time)
+/* the pair is complete if time moved forward */
+static void found_end(struct matcher* m, struct pending* p,
+		      struct timestamp* second, uint64_t exec_time)
 {
-	float delta =  exec_time;
-	fwrite(&delta, sizeof(delta), 1, stdout);
+	p->second    = *second;
+	p->exec_time = exec_time;
+	resolve(m, p, COMPLETE);
 }
 
-pair_fmt_t format_pair = print_pair_csv;
+/* continue the lookup after the matched record ts */
+static void move_anchor(struct matcher* m, struct pending* p,
+			struct timestamp* ts, enum match_state state)
+{
+	p->state      = state;
+	p->anchor     = m->pos;
+	p->anchor_cpu = ts->cpu;
+	list_del(&p->by_irq);
+	if (state == MATCH_EXEC)
+		/* interrupts matter only while accumulating execution time */
+		list_add(m->irq_on_cpu + ts->cpu, &p->by_irq);
+}
 
-static void find_event_by_pid(struct timestamp* first, struct timestamp* end)
+/* event ID mode: ts is the next record on the start record's CPU */
+static void advance_by_id(struct matcher* m, struct pending* p,
+			  struct timestamp* ts)
 {
-	struct timestamp *second;
-	uint64_t exec_time = 0;
-	int interrupted = 0;
+	struct event_ctx* ev = p->ev;
 
-	/* special case: take suspensions into account */
-	if (first->event >= SUSPENSION_RANGE && max_interleaved_skipped == 0) {
-		second = accumulate_exec_time(first, end,
-					      first->event + 1, &exec_time,
-					      &interrupted);
-	} else {
-		second = next_pid(first, end,
-				  first->event + 1, 0,
-				  1, &interrupted);
-		if (second && second->timestamp > first->timestamp)
-			exec_time = second->timestamp - first->timestamp;
+	/* convention: the end->event is start->event + 1 */
+	if (ts->event == ev->id + 1) {
+		ev->interleaved += p->restarts;
+		if (ts_irq_flag(ts)) {
+			ev->interrupted++;
+			if (!ev->want_interrupted) {
+				resolve(m, p, INTERRUPTED);
+				return;
+			}
+		}
+		if (ts_timestamp(ts) <= ts_timestamp(&p->first))
+			resolve(m, p, INCOMPLETE);
+		else if (ts_task_type(&p->first) != TSK_RT &&
+			 ts_task_type(ts) != TSK_RT && !ev->want_best_effort)
+			resolve(m, p, NON_RT);
 		else
-			second = NULL;
+			found_end(m, p, ts,
+				  ts_timestamp(ts) - ts_timestamp(&p->first));
+	} else if (ts->event == ev->id) {
+		resolve(m, p, INCOMPLETE);
+	} else {
+		p->restarts++;
+		if (!want_interleaved)
+			resolve(m, p, INCOMPLETE);
+		else if (ts_irq_flag(ts) && !ev->want_interrupted)
+			resolve(m, p, INTERRUPTED);
 	}
-	if (second) {
-		format_pair(first, second, exec_time);
-		complete++;
-	} else if (!interrupted)
-		incomplete++;
 }
 
-static void find_event_by_eid(struct timestamp *first, struct timestamp* end)
+/* returns non-zero if ts ends the current step of the PID-based lookup */
+static int pid_step_matches(struct pending* p, struct timestamp* ts)
 {
-	struct timestamp *second;
-	uint64_t exec_time;
-	int interrupted = 0;
-
-	second = find_second_ts(first, end, &interrupted);
-	if (second && second->timestamp > first->timestamp) {
-		exec_time = second->timestamp - first->timestamp;
-		if (first->task_type != TSK_RT &&
-			 second->task_type != TSK_RT && !want_best_effort)
-			non_rt++;
+	cmd_t stop_id = p->ev->id + 1;
+
+	switch (p->state) {
+	case MATCH_PID:
+		return ts->event == stop_id || ts->event == 0;
+	case MATCH_EXEC:
+		return ts->event == TS_LOCK_SUSPEND || ts->event == stop_id;
+	case MATCH_RESUME:
+		return ts->event == TS_LOCK_RESUME || ts->event == TS_SCHED_START;
+	case MATCH_SCHED_END:
+		return ts->event == TS_SCHED_END || ts->event == 0;
+	case MATCH_SCHED_RESUME:
+		return ts->event == TS_LOCK_RESUME || ts->event == 0;
+	default:
+		return 0;
+	}
+}
+
+/* PID mode: ts is a later record of the same task */
+static void advance_by_pid(struct matcher* m, struct pending* p,
+			   struct timestamp* ts)
+{
+	if (!pid_step_matches(p, ts)) {
+		if ((long long) (m->pos - p->anchor) > max_interleaved_skipped)
+			/* Don't allow unexpected IDs interleaved.
+			 * Tasks are sequential, there shouldn't be
+			 * anything else. */
+			resolve(m, p, INCOMPLETE);
+		return;
+	}
+
+	switch (p->state) {
+	case MATCH_PID:
+		if (ts_timestamp(ts) > ts_timestamp(&p->first))
+			found_end(m, p, ts,
+				  ts_timestamp(ts) - ts_timestamp(&p->first));
+		else
+			resolve(m, p, INCOMPLETE);
+		break;
+
+	case MATCH_EXEC:
+		if (ts_timestamp(ts) < p->last_time) {
+			/* broken stream */
+			resolve(m, p, INCOMPLETE);
+			break;
+		}
+		/* account for exec until ts */
+		p->exec_time += ts_timestamp(ts) - p->exec_start;
+		if (ts->event == p->ev->id + 1)
+			/* no suspension or preemption */
+			found_end(m, p, ts, p->exec_time);
+		else {
+			/* handle self-suspension: find matching resume */
+			p->last_time = ts_timestamp(ts);
+			move_anchor(m, p, ts, MATCH_RESUME);
+		}
+		break;
+
+	case MATCH_RESUME:
+		if (ts_timestamp(ts) < p->last_time) {
+			resolve(m, p, INCOMPLETE);
+			break;
+		}
+		p->last_time = ts_timestamp(ts);
+		if (ts->event == TS_SCHED_START)
+			/* Was scheduled out, find TS_SCHED_END. */
+			move_anchor(m, p, ts, MATCH_SCHED_END);
+		else {
+			/* Must be a resume => start over. */
+			p->exec_start = ts_timestamp(ts);
+			move_anchor(m, p, ts, MATCH_EXEC);
+		}
+		break;
+
+	case MATCH_SCHED_END:
+		if (ts_timestamp(ts) < p->last_time)
+			resolve(m, p, INCOMPLETE);
+		else
+			/* next find TS_LOCK_RESUME */
+			move_anchor(m, p, ts, MATCH_SCHED_RESUME);
+		break;
+
+	case MATCH_SCHED_RESUME:
+		/* If a resume sample is affected by interrupts we don't care
+		 * since it does not contribute to the reported execution
+		 * cost. */
+		if (ts_timestamp(ts) < p->last_time)
+			resolve(m, p, INCOMPLETE);
 		else {
-			format_pair(first, second, exec_time);
-			complete++;
+			p->last_time  = ts_timestamp(ts);
+			p->exec_start = ts_timestamp(ts);
+			move_anchor(m, p, ts, MATCH_EXEC);
 		}
-	} else if (!interrupted)
-		incomplete++;
+		break;
+
+	default:
+		break;
+	}
 }
 
-static void show_csv(struct timestamp* first, struct timestamp *end)
+static void start_pair(struct matcher* m, struct event_ctx* ev,
+		       struct timestamp* ts)
 {
+	struct pending* p = alloc_pending(m);
 
+	p->ev         = ev;
+	p->first      = *ts;
+	p->anchor     = m->pos;
+	p->anchor_cpu = ts->cpu;
 
-	if (first->cpu == avoid_cpu ||
-	    (only_cpu != -1 && first->cpu != only_cpu)) {
-		avoided++;
-		return;
+	if (!ev->find_by_pid) {
+		p->state = MATCH_ID;
+		list_add(m->by_cpu + ts->cpu, &p->by_key);
+	} else {
+		/* special case: take suspensions into account */
+		if (ts->event >= SUSPENSION_RANGE && max_interleaved_skipped == 0) {
+			p->state      = MATCH_EXEC;
+			p->exec_start = ts_timestamp(ts);
+			p->last_time  = ts_timestamp(ts);
+		} else
+			p->state = MATCH_PID;
+		list_add(m->by_pid + ts_pid(ts), &p->by_key);
+		list_add(m->irq_on_cpu + ts->cpu, &p->by_irq);
 	}
+	list_add(&m->active, &p->active);
 
-	if (find_by_pid)
-		find_event_by_pid(first, end);
+	if (ev->fifo_tail)
+		ev->fifo_tail->fifo_next = p;
 	else
-		find_event_by_eid(first, end);
+		ev->fifo_head = p;
+	ev->fifo_tail = p;
 }
 
-typedef void (*single_fmt_t)(struct timestamp* ts);
-
-static void print_single_csv(struct timestamp* ts)
+/* a hole in the sequence numbers or the end of the trace */
+static void abort_all(struct matcher* m)
 {
-	printf("0, 0, %llu\n",
-	       (unsigned long long) (ts->timestamp));
+	while (m->active.next != &m->active)
+		resolve(m, list_entry(m->active.next, struct pending, active),
+			INCOMPLETE);
 }
 
-static void print_single_bin(struct timestamp* ts)
+static void advance(struct matcher* m, struct timestamp* ts)
 {
-	float delta = ts->timestamp;
+	struct link *l, *n, *head;
+	struct pending* p;
+
+	/* event ID mode */
+	head = m->by_cpu + ts->cpu;
+	for (l = head->next; l != head; l = n) {
+		n = l->next;
+		advance_by_id(m, list_entry(l, struct pending, by_key), ts);
+	}
 
-	fwrite(&delta, sizeof(delta), 1, stdout);
-}
+	/* PID mode: did an interrupt get in the way? */
+	if (ts_irq_flag(ts)) {
+		head = m->irq_on_cpu + ts->cpu;
+		for (l = head->next; l != head; l = n) {
+			n = l->next;
+			p = list_entry(l, struct pending, by_irq);
+			p->ev->interrupted++;
+			if (!p->ev->want_interrupted)
+				resolve(m, p, INTERRUPTED);
+		}
+	}
 
-single_fmt_t single_fmt = print_single_csv;
+	/* PID mode: only care about this PID */
+	head = m->by_pid + ts_pid(ts);
+	for (l = head->next; l != head; l = n) {
+		n = l->next;
+		advance_by_pid(m, list_entry(l, struct pending, by_key), ts);
+	}
+}
 
-static void show_single(struct timestamp* ts)
+static void show_single(struct event_ctx* ev, struct timestamp* ts)
 {
 	if (ts->cpu == avoid_cpu ||
 	    (only_cpu != -1 && ts->cpu != only_cpu)) {
-		avoided++;
-	} else if (ts->task_type == TSK_RT) {
-		single_fmt(ts);
-		complete++;
+		ev->avoided++;
+	} else if (ts_task_type(ts) == TSK_RT) {
+		if (summary_only)
+			histogram_add(summary_for(ev, ts->cpu),
+				      ts_timestamp(ts));
+		/* single records carry no time, so they are not windowed */
+		else if (!window_length)
+			single_fmt(output_for(ev, ts->cpu), ts);
+		ev->complete++;
 	} else
-		non_rt++;
+		ev->non_rt++;
 }
 
-static void show_id(struct timestamp* start, struct timestamp* end,
-		    unsigned long id)
+/* Feed one record to the matcher. by_start[] maps each event ID to the
+ * context for which it is a start (or single) record, by_end[] to the context
+ * for which it is the matching end record. */
+static void match_record(struct matcher* m,
+			 struct event_ctx** by_start, struct event_ctx** by_end,
+			 struct timestamp* ts)
 {
-	while (start !=end && start->event != id + 1) {
-		skipped++;
-		start++;
+	struct event_ctx* ev;
+
+	/* check for for holes in the sequence number */
+	if (!continues(m, ts))
+		abort_all(m);
+	else
+		advance(m, ts);
+
+	ev = by_end[ts->event];
+	if (ev && !ev->seen_end) {
+		/* pairs can't start before the first end record */
+		ev->seen_end = 1;
+		ev->skipped  = m->pos;
 	}
 
-	for (; start != end; start++)
-		if (start->event == id)
-			show_csv(start, end);
+	ev = by_start[ts->event];
+	if (ev && ev->id >= SINGLE_RECORDS_RANGE)
+		show_single(ev, ts);
+	else if (ev) {
+		if (!ev->seen_end)
+			/* skipped, unless an earlier chunk has seen one */
+			ev = ev->pre;
+		if (!ev)
+			;
+		else if (ts->cpu == avoid_cpu ||
+			 (only_cpu != -1 && ts->cpu != only_cpu))
+			ev->avoided++;
+		else
+			start_pair(m, ev, ts);
+	}
+
+	m->last_seqno = ts->seq_no;
+	m->started    = 1;
+	m->pos++;
 }
 
-static void show_single_records(struct timestamp* start, struct timestamp* end,
-				unsigned long id)
+/* Match all pairs that start in ts[lo, hi). Lookups still pending at hi are
+ * completed by looking further ahead, up to the next hole. */
+static void match_range(struct matcher* m,
+			struct event_ctx** by_start, struct event_ctx** by_end,
+			struct timestamp* ts, size_t lo, size_t hi, size_t count)
 {
-	for (; start != end; start++)
-		if (start->event == id)
-			show_single(start);
+	struct event_set relevant;
+	size_t i, next;
+
+	event_set_init(&relevant);
+	for (i = 0; i < 256; i++)
+		if (by_start[i] || by_end[i])
+			event_set_add(&relevant, i);
+
+	m->pos     = lo;
+	m->started = 0;
+	m->hole_free_to = 0;
+	for (i = lo; i < hi; i++) {
+		/* While no lookups are pending, records that neither start
+		 * nor end a pair of interest have no effect and are skipped
+		 * in bulk. */
+		if (m->active.next == &m->active &&
+		    !event_set_contains(&relevant, ts[i].event)) {
+			next = find_event(ts + i, ts + hi, &relevant) - ts;
+			m->pos       += next - i;
+			m->last_seqno = ts[next - 1].seq_no;
+			m->started    = 1;
+			i = next;
+			if (i == hi)
+				break;
+		}
+		match_record(m, by_start, by_end, ts + i);
+	}
+
+	for (; i < count && m->active.next != &m->active; i++) {
+		if (!continues(m, ts + i))
+			break;
+		advance(m, ts + i);
+		m->last_seqno = ts[i].seq_no;
+		m->pos++;
+	}
+	abort_all(m);
 }
 
-static void list_ids(struct timestamp* start, struct timestamp* end)
+static void build_tables(struct event_ctx* events, int nr_events,
+			 struct event_ctx** by_start, struct event_ctx** by_end)
 {
-	unsigned int already_seen[256] = {0};
-	const char *name;
+	int i;
+
+	memset(by_start, 0, sizeof(struct event_ctx*) * 256);
+	memset(by_end, 0, sizeof(struct event_ctx*) * 256);
+	for (i = 0; i < nr_events; i++) {
+		if (events[i].id > UINT8_MAX)
+			continue;
+		by_start[events[i].id] = events + i;
+		if (events[i].id < SINGLE_RECORDS_RANGE)
+			by_end[events[i].id + 1] = events + i;
+	}
+}
+
+/* Parallel matching.
+ *
+ * The trace is cut into chunks, preferably at holes, and the pairs starting
+ * in each chunk are matched by worker threads. Since a lookup depends only on
+ * the records after its start record, each chunk yields exactly the samples
+ * and counts that a serial pass would produce for its start records. The
+ * main thread appends the per-chunk results in file order.
+ */
+
+static int nr_threads = 1;
+
+#define MIN_CHUNK_RECORDS (1 << 16)
+#define HOLE_SEARCH_RECORDS 4096
+/* chunks handed out ahead of the oldest unmerged one, per thread */
+#define CHUNKS_IN_FLIGHT 4
+
+struct chunk {
+	size_t lo, hi;
+	int done;
+	struct event_ctx* post;
+	struct event_ctx* pre;
+};
+
+struct chunk_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+
+	struct chunk* chunks;
+	size_t nr_chunks;
+	size_t next;
+	size_t merged;
+
+	struct event_ctx* events;
+	int nr_events;
+	struct timestamp* ts;
+	size_t count;
+};
+
+static void* xcalloc(size_t n, size_t size)
+{
+	void* p = calloc(n, size);
+
+	if (!p) {
+		perror("calloc");
+		exit(1);
+	}
+	return p;
+}
+
+static void clone_event(struct event_ctx* clone, struct event_ctx* ev)
+{
+	memset(clone, 0, sizeof(*clone));
+	clone->id               = ev->id;
+	clone->name             = ev->name;
+	clone->find_by_pid      = ev->find_by_pid;
+	clone->want_best_effort = ev->want_best_effort;
+	clone->want_interrupted = ev->want_interrupted;
+	clone->in_memory        = 1;
+}
+
+static void *match_chunks(void* arg)
+{
+	struct chunk_queue* q = arg;
+	struct event_ctx* by_start[256];
+	struct event_ctx* by_end[256];
+	struct matcher m;
+	struct chunk* c;
+	int i;
+
+	init_matcher(&m);
+	while (1) {
+		pthread_mutex_lock(&q->lock);
+		while (q->next < q->nr_chunks &&
+		       q->next >= q->merged + CHUNKS_IN_FLIGHT * nr_threads)
+			pthread_cond_wait(&q->cond, &q->lock);
+		c = q->next < q->nr_chunks ? q->chunks + q->next++ : NULL;
+		pthread_mutex_unlock(&q->lock);
+		if (!c)
+			break;
+
+		c->post = xcalloc(q->nr_events, sizeof(struct event_ctx));
+		c->pre  = xcalloc(q->nr_events, sizeof(struct event_ctx));
+		for (i = 0; i < q->nr_events; i++) {
+			clone_event(c->post + i, q->events + i);
+			clone_event(c->pre + i, q->events + i);
+			c->post[i].pre = c->pre + i;
+		}
+		build_tables(c->post, q->nr_events, by_start, by_end);
+
+		match_range(&m, by_start, by_end, q->ts, c->lo, c->hi, q->count);
+
+		pthread_mutex_lock(&q->lock);
+		c->done = 1;
+		pthread_cond_broadcast(&q->cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+	free(m.by_pid);
+	return NULL;
+}
+
+/* append the samples and counts of a chunk's clone to ev */
+static void merge_event(struct event_ctx* ev, struct event_ctx* part)
+{
+	int i;
+
+	ev->complete    += part->complete;
+	ev->incomplete  += part->incomplete;
+	ev->interrupted += part->interrupted;
+	ev->non_rt      += part->non_rt;
+	ev->interleaved += part->interleaved;
+	ev->avoided     += part->avoided;
+
+	merge_windows(ev, part);
+	merge_summaries(ev, part);
+	if (part->out)
+		outbuf_write(output_for(ev, 0), part->out->buf,
+			     part->out->fill);
+	for (i = 0; i < MAX_CPUS; i++)
+		if (part->cpu_out[i])
+			outbuf_write(output_for(ev, i),
+				     part->cpu_out[i]->buf,
+				     part->cpu_out[i]->fill);
+	close_outputs(part);
+}
+
+static void discard_event(struct event_ctx* part)
+{
+	close_windows(part);
+	close_summaries(part);
+	close_outputs(part);
+}
+
+static void merge_chunk(struct chunk_queue* q, struct chunk* c)
+{
+	struct event_ctx *ev, *post, *pre;
+	int i;
+
+	for (i = 0; i < q->nr_events; i++) {
+		ev   = q->events + i;
+		post = c->post + i;
+		pre  = c->pre + i;
+		if (ev->seen_end)
+			merge_event(ev, pre);
+		else {
+			/* pairs before the first end record are skipped */
+			discard_event(pre);
+			if (post->seen_end) {
+				ev->seen_end = 1;
+				ev->skipped  = post->skipped;
+			}
+		}
+		merge_event(ev, post);
+	}
+	free(c->post);
+	free(c->pre);
+}
 
-	for (; start != end; start++)
-		if (!already_seen[start->event])
-		{
-			already_seen[start->event] = 1;
-			name = event2str(start->event);
-			if (name)
-				printf("%s\n", name);
-			else
-				printf("%d\n", start->event);
+static void match_parallel(struct event_ctx* events, int nr_events,
+			   struct timestamp* ts, size_t count)
+{
+	struct chunk_queue q;
+	pthread_t* threads;
+	size_t chunk_size, lo, hi, max_hi;
+	int i;
+
+	chunk_size = count / (CHUNKS_IN_FLIGHT * nr_threads);
+	if (chunk_size < MIN_CHUNK_RECORDS)
+		chunk_size = MIN_CHUNK_RECORDS;
+
+	memset(&q, 0, sizeof(q));
+	q.chunks = xcalloc(count / chunk_size + 1, sizeof(struct chunk));
+	for (lo = 0; lo < count; lo = hi) {
+		hi = lo + chunk_size < count ? lo + chunk_size : count;
+		/* prefer to split at a hole: nothing has to be looked up
+		 * beyond it */
+		if (segments) {
+			max_hi = hi + chunk_size < count ?
+				hi + chunk_size : count;
+			if (hi < count && segment_end(segments, hi - 1) <= max_hi)
+				hi = segment_end(segments, hi - 1);
+		} else {
+			max_hi = hi + HOLE_SEARCH_RECORDS < count ?
+				hi + HOLE_SEARCH_RECORDS : count;
+			while (hi < max_hi &&
+			       ts[hi - 1].seq_no + 1 == ts[hi].seq_no)
+				hi++;
+			if (hi == max_hi && max_hi < count)
+				hi = lo + chunk_size;
+		}
+		q.chunks[q.nr_chunks].lo = lo;
+		q.chunks[q.nr_chunks].hi = hi;
+		q.nr_chunks++;
+	}
+
+	q.events    = events;
+	q.nr_events = nr_events;
+	q.ts        = ts;
+	q.count     = count;
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.cond, NULL);
+
+	threads = xcalloc(nr_threads, sizeof(pthread_t));
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(threads + i, NULL, match_chunks, &q)) {
+			perror("pthread_create");
+			exit(1);
 		}
+
+	for (q.merged = 0; q.merged < q.nr_chunks; ) {
+		pthread_mutex_lock(&q.lock);
+		while (!q.chunks[q.merged].done)
+			pthread_cond_wait(&q.cond, &q.lock);
+		pthread_mutex_unlock(&q.lock);
+
+		merge_chunk(&q, q.chunks + q.merged);
+
+		pthread_mutex_lock(&q.lock);
+		q.merged++;
+		pthread_cond_broadcast(&q.cond);
+		pthread_mutex_unlock(&q.lock);
+	}
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(q.chunks);
+}
+
+static void show_all(struct event_ctx* events, int nr_events,
+		     struct timestamp* start, struct timestamp* end)
+{
+	struct event_ctx* by_start[256];
+	struct event_ctx* by_end[256];
+	struct matcher m;
+	int i;
+
+	if (nr_threads > 1 && end - start > MIN_CHUNK_RECORDS)
+		match_parallel(events, nr_events, start, end - start);
+	else {
+		build_tables(events, nr_events, by_start, by_end);
+		init_matcher(&m);
+		match_range(&m, by_start, by_end, start, 0, end - start,
+			    end - start);
+		free(m.by_pid);
+	}
+
+	for (i = 0; i < nr_events; i++)
+		if (events[i].id < SINGLE_RECORDS_RANGE && !events[i].seen_end)
+			events[i].skipped = end - start;
+}
+
+/* Streaming input: records are read from a pipe and put into sequence-number
+ * order by a bounded reorder window, as ftsort would do. If present is
+ * non-NULL, the events encountered are flagged in it. Returns the number of
+ * records. */
+static size_t show_stream(struct event_ctx* events, int nr_events,
+			  struct reorder_stream* stream, unsigned int* present)
+{
+	struct event_ctx* by_start[256];
+	struct event_ctx* by_end[256];
+	struct timestamp* ts;
+	struct matcher m;
+	int i;
+
+	build_tables(events, nr_events, by_start, by_end);
+	init_matcher(&m);
+	m.started = 0;
+	while ((ts = reorder_next(stream))) {
+		if (present)
+			present[ts->event] = 1;
+		match_record(&m, by_start, by_end, ts);
+	}
+	abort_all(&m);
+	free(m.by_pid);
+
+	for (i = 0; i < nr_events; i++)
+		if (events[i].id < SINGLE_RECORDS_RANGE && !events[i].seen_end)
+			events[i].skipped = stream->count;
+
+	fprintf(stderr,
+		"Holes       : %10u\n"
+		"Reordered   : %10u\n"
+		"Seq. constr.: %10u\n",
+		stream->stats.holes, stream->stats.reordered,
+		stream->stats.aborted_moves);
+
+	return stream->count;
 }
 
+static void list_id(unsigned int* already_seen, struct timestamp* ts)
+{
+	const char *name;
+
+	if (!already_seen[ts->event])
+	{
+		already_seen[ts->event] = 1;
+		name = event2str(ts->event);
+		if (name)
+			printf("%s\n", name);
+		else
+			printf("%d\n", ts->event);
+	}
+}
+
+/* Flag the events present in [start, end). Calls fn for the first record of
+ * each event, if fn is non-NULL. */
+static void find_present(struct timestamp* start, struct timestamp* end,
+			 unsigned int* present,
+			 void (*fn)(unsigned int*, struct timestamp*))
+{
+	unsigned int seen[256] = {0};
+	struct event_set unseen;
+	int i;
+
+	event_set_init(&unseen);
+	for (i = 0; i < 256; i++)
+		event_set_add(&unseen, i);
+
+	while ((start = find_event(start, end, &unseen)) != end) {
+		if (fn)
+			fn(seen, start);
+		present[start->event] = 1;
+		event_set_remove(&unseen, start->event);
+		start++;
+	}
+}
+
+static void list_ids(struct timestamp* start, struct timestamp* end)
+{
+	unsigned int present[256] = {0};
+
+	find_present(start, end, present, list_id);
+}
+
+static void list_stream_ids(struct reorder_stream* stream)
+{
+	unsigned int already_seen[256] = {0};
+	struct timestamp* ts;
+
+	while ((ts = reorder_next(stream)))
+		list_id(already_seen, ts);
+}
 
 #define USAGE								\
-	"Usage: ft2csv [-r] [-i] [-s NUM] [-b] [-a CPU] [-o CPU] <event_name>  <logfile> \n" \
+	"Usage: ft2csv [-r|-R|-C] [-i] [-s NUM] [-b] [-a CPU] [-o CPU] <event_name>  <logfile> \n" \
+	"       ft2csv -m [-c] [-B EVENT] [OPTIONS] <logfile> \n" \
+	"       ft2csv -m [OPTIONS] - [<name>] \n" \
+	"   <logfile> may be '-' to read a trace (e.g., from ftcat) from stdin;\n" \
+	"   records are reordered by sequence number as ftsort would do.\n" \
+	"   <name> determines the output file names in multi-event mode.\n" \
 	"   -i: ignore interleaved  -- ignore samples if start "	\
 	"and end are non-consecutive\n"					\
 	"   -s: max_interleaved_skipped -- maximum number of skipped interleaved samples. "	\
 	"must be used in conjunction with [-i] option \n" \
 	"   -b: best effort         -- don't skip non-rt time stamps \n" \
+	"   -B: best effort (one)   -- like -b, but only for the given event\n" \
 	"   -r: raw binary format   -- don't produce .csv output \n"	\
+	"   -R: compact raw format  -- lossless binary output with the\n" \
+	"                              narrowest integer type (see samples.h)\n" \
+	"   -C: columnar format     -- binary output with all sample fields,\n" \
+	"                              stored column by column (see columns.h)\n" \
+	"   -w: time windows        -- instead of samples, write one row per\n" \
+	"                              window of the given number of cycles and\n" \
+	"                              CPU: start, cpu, n, max, p99.9, p99, p95,\n" \
+	"                              avg, med, min (pair events only)\n" \
+	"   -S: summary only        -- instead of samples, print n, max, p99.9,\n" \
+	"                              p99, p95, avg, and min of each event\n" \
+	"   -E: error bound         -- max. relative error of the percentiles\n" \
+	"                              reported by -w and -S, in percent (def. 1)\n" \
 	"   -a: avoid CPU           -- skip samples from a specific CPU\n" \
 	"   -o: only CPU            -- skip all samples from other CPUs\n" \
 	"   -x: allow interrupts    -- don't skip samples with IRQ-happned flag\n" \
+	"   -X: allow interrupts (one) -- like -x, but only for the given event\n" \
 	"   -l: list events         -- list the events present in the file\n" \
+	"   -m: multi-event mode    -- extract all events present in the file\n" \
+	"                              in one pass, one output file per event\n" \
+	"   -c: split by CPU        -- with -m, one output file per event and CPU\n" \
+	"   -j: threads             -- match pairs with the given number of threads\n" \
+	"   -O: byte order          -- auto (default), native, or swapped\n" \
 	"   -h: help                -- show this help message\n" \
 	""
 
@@ -414,17 +1454,216 @@ static void die(char* msg)
 	exit(1);
 }
 
-#define OPTS "ibrs:a:o:pexhl"
+static int parse_event(const char* name, cmd_t *id)
+{
+	char event_name[80];
+
+	if (str2event(name, id))
+		return 1;
+	/* see if it is a short name */
+	snprintf(event_name, sizeof(event_name), "%s_START", name);
+	return str2event(event_name, id);
+}
+
+#define MAX_EVENT_OPTS 32
+
+static cmd_t be_ids[MAX_EVENT_OPTS];
+static cmd_t irq_ids[MAX_EVENT_OPTS];
+static int   nr_be_ids  = 0;
+static int   nr_irq_ids = 0;
+
+static int id_listed(cmd_t id, cmd_t* ids, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (ids[i] == id)
+			return 1;
+	return 0;
+}
+
+static void add_event_opt(const char* name, cmd_t* ids, int *count)
+{
+	if (*count == MAX_EVENT_OPTS)
+		die("Too many per-event options.");
+	if (!parse_event(name, ids + *count))
+		die("Unknown event!");
+	(*count)++;
+}
+
+static void init_event(struct event_ctx* ev, cmd_t id, const char* name)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->id   = id;
+	ev->name = name;
+	ev->want_best_effort = want_best_effort ||
+		id_listed(id, be_ids, nr_be_ids);
+	ev->want_interrupted = want_interrupted ||
+		id_listed(id, irq_ids, nr_irq_ids);
+	if (find_by_pid == AUTO_SELECT)
+		ev->find_by_pid = id <= PID_RECORDS_RANGE;
+	else
+		ev->find_by_pid = find_by_pid;
+}
+
+static void report(struct event_ctx* ev, size_t count)
+{
+	if (count == ev->skipped)
+		fprintf(stderr, "Event %s not present.\n",
+			ev->name);
+	else
+		fprintf(stderr,
+			"Total       : %10d\n"
+			"Skipped     : %10d\n"
+			"Avoided     : %10d\n"
+			"Complete    : %10d\n"
+			"Incomplete  : %10d\n"
+			"Non RT      : %10d\n"
+			"Interleaved : %10d\n"
+			"Interrupted : %10d\n",
+			(int) count,
+			ev->skipped, ev->avoided, ev->complete,
+			ev->incomplete, ev->non_rt,
+			ev->interleaved, ev->interrupted);
+}
+
+/* Name used by ft-extract-samples for the event: the event name without
+ * _START/_END suffix, or the raw event number. */
+static char* short_event_name(uint8_t event)
+{
+	const char* name = event2str(event);
+	char buf[80];
+	size_t len;
+
+	if (!name) {
+		snprintf(buf, sizeof(buf), "%u", event);
+		return strdup(buf);
+	}
+	snprintf(buf, sizeof(buf), "%s", name);
+	len = strlen(buf);
+	if (len > 6 && !strcmp(buf + len - 6, "_START"))
+		buf[len - 6] = '\0';
+	else if (len > 4 && !strcmp(buf + len - 4, "_END"))
+		buf[len - 4] = '\0';
+	return strdup(buf);
+}
+
+/* <trace>_overhead=<EVENT>, with the trace's directory and .bin extension
+ * stripped and the first underscore in the event name replaced by a dash. */
+static char* target_name(const char* trace, const char* event)
+{
+	const char* base = strrchr(trace, '/');
+	char buf[4096];
+	char* pos;
+
+	base = base ? base + 1 : trace;
+	snprintf(buf, sizeof(buf), "%s", base);
+	if ((pos = strstr(buf, ".bin")))
+		memmove(pos, pos + 4, strlen(pos + 4) + 1);
+	snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+		 "_overhead=%s", event);
+	pos = strchr(buf + strlen(buf) - strlen(event), '_');
+	if (pos)
+		*pos = '-';
+	return strdup(buf);
+}
+
+/* Extract all events present in the trace. With streaming input (stream
+ * non-NULL), the present events are not known in advance, so contexts are
+ * set up for all events and only those encountered are reported. */
+static void extract_all(const char* trace, struct timestamp* ts,
+			struct timestamp* end, struct reorder_stream* stream)
+{
+	struct event_ctx* events;
+	struct event_ctx* ev;
+	unsigned int present[256] = {0};
+	int ctx_of[256];
+	int used[256] = {0};
+	int nr_events = 0, i, j;
+	size_t count;
+	char* name;
+	cmd_t id;
+
+	if (stream)
+		for (i = 0; i < 256; i++)
+			present[i] = 1;
+	else
+		find_present(ts, end, present, NULL);
+
+	events = xcalloc(256, sizeof(struct event_ctx));
+	for (i = 0; i < 256; i++) {
+		ctx_of[i] = -1;
+		if (!present[i])
+			continue;
+		name = short_event_name(i);
+		if (!parse_event(name, &id) || id > UINT8_MAX) {
+			free(name);
+			continue;
+		}
+		for (j = 0; j < nr_events && events[j].id != id; j++)
+			;
+		ctx_of[i] = j;
+		if (j < nr_events) {
+			free(name);
+			continue;
+		}
+		ev = events + nr_events++;
+		init_event(ev, id, name);
+		ev->target = target_name(trace, name);
+		if (!split_by_cpu && !stream && !summary_only)
+			output_for(ev, 0);
+	}
+
+	if (stream) {
+		memset(present, 0, sizeof(present));
+		count = show_stream(events, nr_events, stream, present);
+	} else {
+		show_all(events, nr_events, ts, end);
+		count = end - ts;
+	}
+
+	for (i = 0; i < 256; i++)
+		if (present[i] && ctx_of[i] >= 0)
+			used[ctx_of[i]] = 1;
+
+	for (i = 0; i < nr_events; i++) {
+		ev = events + i;
+		if (!used[i])
+			continue;
+		if (summary_only) {
+			report(ev, count);
+			close_summaries(ev);
+			continue;
+		}
+		if (!split_by_cpu)
+			output_for(ev, 0);
+		fprintf(stderr, "%s %s >> %s%s.%s\n", trace, ev->name,
+			ev->target, split_by_cpu ? "_core=*" : "",
+			output_ext);
+		report(ev, count);
+		close_windows(ev);
+		close_outputs(ev);
+	}
+}
+
+#define OPTS "ibrRCs:a:o:pexhlmcj:B:X:w:SE:O:"
 
 int main(int argc, char** argv)
 {
 	void* mapped;
 	size_t size, count;
 	struct timestamp *ts, *end;
+	struct reorder_stream stream;
+	struct segment_index index;
+	enum trace_order order = TRACE_AUTO;
+	const char* trace;
+	const char* trace_name = "stdin";
+	struct event_ctx ev;
 	cmd_t id;
 	int opt;
-	char event_name[80];
 	int list_events = 0;
+	int multi_event = 0;
+	double error_bound;
 
 	while ((opt = getopt(argc, argv, OPTS)) != -1) {
 		switch (opt) {
@@ -441,15 +1680,65 @@ int main(int argc, char** argv)
 			want_interrupted = 1;
 			fprintf(stderr, "Not filtering disturbed-by-interrupt samples.\n");
 			break;
+		case 'X':
+			add_event_opt(optarg, irq_ids, &nr_irq_ids);
+			fprintf(stderr, "Not filtering disturbed-by-interrupt %s samples.\n",
+				optarg);
+			break;
 		case 'b':
 			fprintf(stderr,"Not filtering samples from best-effort"
 				" tasks.\n");
 			want_best_effort = 1;
 			break;
+		case 'B':
+			add_event_opt(optarg, be_ids, &nr_be_ids);
+			fprintf(stderr,"Not filtering %s samples from best-effort"
+				" tasks.\n", optarg);
+			break;
 		case 'r':
 			fprintf(stderr, "Generating binary, NumPy-compatible output.\n");
 			single_fmt  = print_single_bin;
 			format_pair = print_pair_bin;
+			output_ext  = "float32";
+			break;
+		case 'R':
+			fprintf(stderr, "Generating compact raw binary output.\n");
+			single_fmt  = print_single_raw;
+			format_pair = print_pair_raw;
+			output_ext  = "samples";
+			spool_writer = write_samples;
+			spool_flags  = O_APPEND;
+			break;
+		case 'C':
+			fprintf(stderr, "Generating columnar binary output.\n");
+			single_fmt  = print_single_cols;
+			format_pair = print_pair_cols;
+			output_ext  = "cols";
+			spool_writer = write_columns;
+			spool_flags  = O_TRUNC;
+			break;
+		case 'w':
+			window_length = strtoull(optarg, NULL, 10);
+			if (!window_length)
+				die("Bad argument -w: need positive number.");
+			fprintf(stderr, "Reporting statistics for windows of "
+				"%llu cycles.\n",
+				(unsigned long long) window_length);
+			break;
+		case 'S':
+			summary_only = 1;
+			fprintf(stderr, "Reporting summary statistics only.\n");
+			break;
+		case 'E':
+			error_bound = atof(optarg);
+			if (error_bound <= 0 || error_bound >= 100)
+				die("Bad argument -E: need percentage.");
+			/* relative error of at most 2^-sub_bits */
+			for (histogram_sub_bits = 1;
+			     histogram_sub_bits < 20 &&
+				     100.0 / (1 << histogram_sub_bits) > error_bound;
+			     histogram_sub_bits++)
+				;
 			break;
 		case 'a':
 			avoid_cpu = atoi(optarg);
@@ -472,6 +1761,24 @@ int main(int argc, char** argv)
 		case 'l':
 			list_events = 1;
 			break;
+		case 'm':
+			multi_event = 1;
+			break;
+		case 'c':
+			split_by_cpu = 1;
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			if (nr_threads < 1)
+				die("Bad argument -j: need positive number.");
+			fprintf(stderr, "Matching pairs with %d threads.\n",
+				nr_threads);
+			break;
+		case 'O':
+			if (parse_trace_order(optarg, &order))
+				die("Bad argument -O: need auto, native, "
+				    "or swapped.");
+			break;
 		case 'h':
 			errno = 0;
 			die("");
@@ -482,62 +1789,88 @@ int main(int argc, char** argv)
 		}
 	}
 
+	/* select the event scan kernel before any threads use it */
+	find_event_kernel();
 
-	if (list_events) {
-		/* no event ID specified */
-		if (argc - optind != 1)
+	if (window_length && summary_only)
+		die("-w and -S cannot be combined");
+
+	if (window_length) {
+		/* statistics replace the samples */
+		output_ext   = "windows";
+		spool_writer = NULL;
+	}
+
+	if (split_by_cpu && !multi_event)
+		die("-c requires -m");
+
+	if (list_events || multi_event) {
+		/* no event ID specified; with stdin input, the trace name
+		 * for output files may follow */
+		trace = argv[optind];
+		if (argc - optind == 2 && !strcmp(trace, "-"))
+			trace_name = argv[optind + 1];
+		else if (argc - optind != 1)
 			die("arguments missing");
-		if (map_file(argv[optind], &mapped, &size))
-			die("could not map file");
 	} else {
 		if (argc - optind != 2)
 			die("arguments missing");
-		if (map_file(argv[optind + 1], &mapped, &size))
-			die("could not map file");
+		trace = argv[optind + 1];
 	}
 
-	ts    = (struct timestamp*) mapped;
-	count = size / sizeof(struct timestamp);
-	end   = ts + count;
+	if (!strcmp(trace, "-")) {
+		if (nr_threads > 1)
+			fprintf(stderr, "Note: -j is ignored for stdin input.\n");
+		init_reorder_stream(&stream, STDIN_FILENO);
+		stream.order = order;
+		ts = end = NULL;
+	} else {
+		if (map_file(trace, &mapped, &size))
+			die("could not map file");
+		ts    = (struct timestamp*) mapped;
+		count = size / sizeof(struct timestamp);
+		end   = ts + count;
+		trace_name = trace;
+		/* the mapping is private */
+		if (ft_decode(ts, count, order))
+			fprintf(stderr, "Note: converting %s from foreign "
+				"byte order.\n", trace);
+		if (!load_segment_index(trace, ts, count, 0, &index))
+			segments = &index;
+	}
 
 	if (list_events) {
-		list_ids(ts, end);
+		if (ts)
+			list_ids(ts, end);
+		else
+			list_stream_ids(&stream);
 		return 0;
 	}
 
-	if (!str2event(argv[optind], &id)) {
-		/* see if it is a short name */
-		snprintf(event_name, sizeof(event_name), "%s_START",
-			  argv[optind]);
-		if (!str2event(event_name, &id))
-			die("Unknown event!");
+	if (summary_only)
+		print_summary_header();
+
+	if (multi_event) {
+		extract_all(trace_name, ts, end, ts ? NULL : &stream);
+		return 0;
 	}
 
-	if (find_by_pid == AUTO_SELECT)
-		find_by_pid = id <= PID_RECORDS_RANGE;
+	if (!parse_event(argv[optind], &id))
+		die("Unknown event!");
 
-	if (id >= SINGLE_RECORDS_RANGE)
-		show_single_records(ts, end, id);
-	else
-		show_id(ts, end, id);
+	init_event(&ev, id, argv[optind]);
+	if (!summary_only)
+		output_for(&ev, 0);
 
-	if (count == skipped)
-		fprintf(stderr, "Event %s not present.\n",
-			argv[optind]);
+	if (ts)
+		show_all(&ev, 1, ts, end);
 	else
-		fprintf(stderr,
-			"Total       : %10d\n"
-			"Skipped     : %10d\n"
-			"Avoided     : %10d\n"
-			"Complete    : %10d\n"
-			"Incomplete  : %10d\n"
-			"Non RT      : %10d\n"
-			"Interleaved : %10d\n"
-			"Interrupted : %10d\n",
-			(int) count,
-			skipped, avoided, complete,
-			incomplete, non_rt,
-			interleaved, interrupted);
+		count = show_stream(&ev, 1, &stream, NULL);
+
+	close_windows(&ev);
+	close_summaries(&ev);
+	close_outputs(&ev);
+	report(&ev, count);
 
 	return 0;
 }
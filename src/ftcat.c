@@ -1,4 +1,4 @@
-/*    ftcat -- Pump events from a Feather-Trace device to stdout.
+/*    ftcat -- Pump events from Feather-Trace devices to stdout or files.
  *    Copyright (C) 2007, 2008  B. Brandenburg.
  *
  *    This program is free software; you can redistribute it and/or modify
@@ -15,6 +15,9 @@
  *    with this program; if not, write to the Free Software Foundation, Inc.,
  *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* splice() */
+#endif
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -23,8 +26,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #include "migration.h" /* from liblitmus */
 #include "timestamp.h"
@@ -34,43 +39,182 @@
 int verbose = 0;
 #define vprintf(fmt, args...) if (verbose) { printf(fmt, ## args); }
 
-static int fd;
-static int event_count = 0;
-static cmd_t  ids[MAX_EVENTS];
-static unsigned long total_bytes = 0;
+/* Single-producer/single-consumer ring between the thread that drains a
+ * device and the thread that writes its data to storage, so that stalls in
+ * the file system do not stall the drain. head and tail count the bytes
+ * produced and consumed; each is written by one side only and published with
+ * release semantics. The size is a multiple of RING_GRANULE, so that a read
+ * that ends at the end of the ring is never shorter than a record. */
+struct ring {
+	char* buf;
+	size_t size;
+	size_t head __attribute__((aligned(64)));
+	size_t tail __attribute__((aligned(64)));
+	int done;            /* the drain thread is finished */
+	int failed;          /* the writer gave up */
+
+	/* maintained by the drain thread */
+	size_t high_water;
+	unsigned long full;  /* times the drain had to wait for space */
+	pthread_t writer;
+
+	/* flight recorder: the stream offset, plus one, after which the
+	 * post-trigger data of the latest trigger begins; 0: none yet.
+	 * Written by any drain thread, only ever raised. */
+	size_t trigger_at;
+
+	/* maintained by the writer (flight recorder) */
+	unsigned long written;
+	unsigned long dumps;
+};
+
+#define MAX_TRIGGERS 16
+
+/* Flight recorder (-F): a pair trigger fires if the END record of an event
+ * follows its START record on the same device after more than the given
+ * number of cycles. Interrupted pairs are ignored, as in ft2csv. */
+struct pair_trigger {
+	const char* name;
+	cmd_t start, end;
+	uint64_t cycles;
+};
+
+/* Ring of files (-R): the output of a device rotates through a fixed set
+ * of preallocated files, <out>.000, <out>.001, ..., so that disk usage is
+ * bounded; the oldest file is overwritten. Files end on record boundaries.
+ * <out>.idx lists the files in the order in which they were written, with
+ * the range of sequence numbers they hold; it is replaced atomically
+ * whenever a file is opened or sealed. */
+struct ring_file {
+	unsigned long generation; /* files opened before this one */
+	uint32_t first_seq, last_seq;
+	unsigned long records;
+	int state;
+};
+
+enum { RING_FILE_UNUSED, RING_FILE_OPEN, RING_FILE_SEALED };
+
+static const char* ring_file_state_name[] = {
+	[RING_FILE_UNUSED] = "unused",
+	[RING_FILE_OPEN]   = "open",
+	[RING_FILE_SEALED] = "sealed",
+};
+
+struct rotation {
+	struct ring_file* info;
+	unsigned int slot;        /* file being written */
+	unsigned long generation; /* files opened so far */
+	size_t fill;              /* bytes in the file being written */
+	/* a record that was written only in part so far */
+	char partial[sizeof(struct timestamp)];
+	size_t partial_fill;
+};
+
+/* A device and where its data goes. Each device is drained by a thread of
+ * its own, pinned to the CPU whose buffer the device exposes. */
+struct device {
+	const char* name;
+	const char* out_name; /* NULL: stdout */
+	int fd;
+	int out;
+	int cpu;              /* to pin the drain thread to, or -1 */
+
+	char** events;        /* names given on the command line */
+	int nr_events;
+	int event_count;      /* enabled so far */
+	cmd_t ids[MAX_EVENTS];
+	int disabled;
+
+	unsigned long total_bytes;
+	pthread_t thread;
+	struct ring ring;
+
+	struct rotation rotation;
+
+	/* timestamps of the open START records of the pair triggers */
+	uint64_t started[MAX_TRIGGERS];
+	int open[MAX_TRIGGERS];
+};
+
+static struct device* devices;
+static int nr_devices = 0;
+
 static unsigned long stop_after_bytes = 0;
+static int force_read_write = 0;
+
+/* a page holds whole records */
+#define RING_GRANULE 4096
+/* four chunks; small, since there is a ring per device. Pages are only
+ * used once data is read into them. */
+#define DEFAULT_RING_SIZE (4 * 1024 * 1024)
+/* free space the drain waits for, if the ring is full */
+#define RING_MIN_READ 4096
+/* how long to wait for the other side of the ring (in us) */
+#define RING_POLL_DRAIN 100
+#define RING_POLL_WRITER 1000
+
+static unsigned long ring_size = DEFAULT_RING_SIZE;
+
+#define MAX_RING_FILES 1000
+
+static unsigned int nr_ring_files = 0;
+static size_t ring_file_size;
+
+/* Flight recorder: keep the last flight_window bytes of each device in its
+ * ring, and write them, plus the post_trigger bytes that follow, only once
+ * a trigger fires on any device. */
+static unsigned long flight_window = 0;
+static unsigned long post_trigger = 0;
+static uint64_t latency_trigger = 0; /* ns; 0: none */
+static struct pair_trigger pair_triggers[MAX_TRIGGERS];
+static int nr_pair_triggers = 0;
+/* bumped by the drain threads */
+static unsigned long nr_triggers = 0;
 
-static int disable_all(int fd)
+/* the drain threads are pinned; the events are enabled */
+static pthread_barrier_t pinned, enabled;
+
+static int disable_all(struct device* dev)
 {
 	int disabled = 0;
 	int i;
 
-	fprintf(stderr, "Disabling %d events.\n", event_count);
-	for (i = 0; i < event_count; i++)
-		if (ioctl(fd, DISABLE_CMD, ids[i]) < 0)
+	fprintf(stderr, "Disabling %d events.\n", dev->event_count);
+	for (i = 0; i < dev->event_count; i++)
+		if (ioctl(dev->fd, DISABLE_CMD, dev->ids[i]) < 0)
 			perror("ioctl(DISABLE_CMD)");
 		else
 			disabled++;
 
-	return  disabled == event_count;
+	return  disabled == dev->event_count;
+}
+
+/* Disable the events of dev, unless that happened already. Called from
+ * signal handlers, too. */
+static void disable_device(struct device* dev)
+{
+	if (__sync_lock_test_and_set(&dev->disabled, 1))
+		return;
+	if (!disable_all(dev))
+		fprintf(stderr, "%s: disable_all: %m\n", dev->name);
 }
 
-static int enable_event(int fd, char* str)
+static int enable_event(struct device* dev, char* str)
 {
 	cmd_t   *id;
 	int err;
 
-	id = ids + event_count;
+	id = dev->ids + dev->event_count;
 	if (!str2event(str, id)) {
 		errno = EINVAL;
 		return 0;
 	}
-	event_count += 1;
+	dev->event_count += 1;
 
-	err = ioctl(fd, ENABLE_CMD, *id);
+	err = ioctl(dev->fd, ENABLE_CMD, *id);
 
 	if (err < 0)
-		fprintf(stderr, "ioctl(%d, %d, %d) => %d (errno: %d)\n", fd, (int) ENABLE_CMD, *id,
+		fprintf(stderr, "ioctl(%d, %d, %d) => %d (errno: %d)\n", dev->fd, (int) ENABLE_CMD, *id,
 		       err, errno);
 
 	return err == 0;
@@ -100,16 +244,638 @@ static int calibrate_cycle_offsets(int fd)
 }
 
 
-static void cat2stdout(int fd)
+/* bytes moved from the device at once */
+#define CHUNK_SIZE (1024 * 1024)
+/* stop_after_bytes is honored at this granularity */
+#define STOP_GRANULARITY 4096
+
+enum copy_mode {
+	COPY_RING,          /* read(2) into a ring, emptied by another thread */
+	COPY_SPLICE_DIRECT, /* splice(2) from the device to stdout (a pipe) */
+	COPY_SPLICE,        /* splice(2) through a pipe of our own */
+	COPY_READ_WRITE,    /* large aligned read(2)s and write(2)s */
+};
+
+static const char* copy_mode_name[] = {
+	[COPY_RING]          = "ring",
+	[COPY_SPLICE_DIRECT] = "splice",
+	[COPY_SPLICE]        = "splice via pipe",
+	[COPY_READ_WRITE]    = "read/write",
+};
+
+static size_t next_chunk(struct device* dev)
+{
+	unsigned long left;
+
+	if (!stop_after_bytes)
+		return CHUNK_SIZE;
+	left = stop_after_bytes - dev->total_bytes;
+	left += STOP_GRANULARITY - 1;
+	left -= left % STOP_GRANULARITY;
+	return left < CHUNK_SIZE ? left : CHUNK_SIZE;
+}
+
+static int write_all(int out, const char* buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(out, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Copy len bytes that are stuck in a pipe to out the slow way. */
+static int drain_pipe(int pipe_rd, int out, size_t len, char* buf)
+{
+	ssize_t rd;
+
+	while (len) {
+		rd = read(pipe_rd, buf, len < CHUNK_SIZE ? len : CHUNK_SIZE);
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd <= 0 || write_all(out, buf, rd))
+			return -1;
+		len -= rd;
+	}
+	return 0;
+}
+
+static int stopped(struct device* dev)
+{
+	return stop_after_bytes && dev->total_bytes >= stop_after_bytes;
+}
+
+static int done_after(struct device* dev, ssize_t moved)
+{
+	dev->total_bytes += moved;
+	return stopped(dev);
+}
+
+static void cat_read_write(struct device* dev, char* buf)
+{
+	ssize_t rd;
+
+	while (1) {
+		rd = read(dev->fd, buf, next_chunk(dev));
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd <= 0)
+			break;
+		if (write_all(dev->out, buf, rd)) {
+			perror("write");
+			break;
+		}
+		if (done_after(dev, rd))
+			break;
+	}
+}
+
+/* Move the device's data to out without copying it through user space, if
+ * the device and out support it. Returns the mode to fall back to if they do
+ * not; in that case, no data has been lost. */
+static enum copy_mode cat_splice(struct device* dev, enum copy_mode mode,
+				 char* buf)
+{
+	int pipe_fds[2] = {-1, -1};
+	int fd = dev->fd, out = dev->out, to = out;
+	ssize_t got, put, done;
+	int moved_any = 0, failed = 0;
+
+	if (mode == COPY_SPLICE) {
+		if (pipe(pipe_fds))
+			return COPY_READ_WRITE;
+		/* make room for a whole chunk, if we are allowed to */
+		fcntl(pipe_fds[1], F_SETPIPE_SZ, CHUNK_SIZE);
+		to = pipe_fds[1];
+	}
+
+	while (1) {
+		got = splice(fd, NULL, to, NULL, next_chunk(dev),
+			     SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 && !moved_any &&
+		    (errno == EINVAL || errno == ENOSYS)) {
+			/* the device does not support splicing */
+			mode = COPY_READ_WRITE;
+			break;
+		}
+		if (got < 0)
+			perror("splice");
+		if (got <= 0)
+			break;
+		moved_any = 1;
+
+		for (done = 0; mode == COPY_SPLICE && done < got; done += put) {
+			put = splice(pipe_fds[0], NULL, out, NULL, got - done,
+				     SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (put < 0 && errno == EINTR)
+				put = 0;
+			else if (put < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				/* out does not support splicing; get the data
+				 * out of the pipe the slow way */
+				failed = drain_pipe(pipe_fds[0], out,
+						    got - done, buf);
+				if (failed)
+					perror("write");
+				else
+					mode = COPY_READ_WRITE;
+				break;
+			} else if (put <= 0) {
+				perror("splice");
+				failed = 1;
+				break;
+			}
+		}
+		if (failed || done_after(dev, got) || mode == COPY_READ_WRITE)
+			break;
+	}
+
+	if (pipe_fds[0] >= 0) {
+		close(pipe_fds[0]);
+		close(pipe_fds[1]);
+	}
+	return mode;
+}
+
+static void init_ring(struct ring* ring)
+{
+	ring->size = ring_size + RING_GRANULE - 1;
+	ring->size -= ring->size % RING_GRANULE;
+	if (posix_memalign((void**) &ring->buf, sysconf(_SC_PAGESIZE),
+			   ring->size)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+}
+
+static void ring_file_name(char* buf, size_t size, const struct device* dev,
+			   unsigned int slot)
+{
+	snprintf(buf, size, "%s.%03u", dev->out_name, slot);
+}
+
+static void write_file_ring_index(struct device* dev)
+{
+	struct rotation* rot = &dev->rotation;
+	struct ring_file* info;
+	char name[4096], tmp[4096], file[4096];
+	unsigned long gen, oldest;
+	unsigned int i;
+	FILE* f;
+
+	snprintf(name, sizeof(name), "%s.idx", dev->out_name);
+	snprintf(tmp, sizeof(tmp), "%s.idx.tmp", dev->out_name);
+	f = fopen(tmp, "w");
+	if (!f) {
+		perror(tmp);
+		return;
+	}
+	fprintf(f, "# generation first_seq last_seq records state file\n");
+	/* oldest first */
+	oldest = rot->generation > nr_ring_files ?
+		rot->generation - nr_ring_files : 0;
+	for (gen = oldest; gen < rot->generation; gen++) {
+		i = gen % nr_ring_files;
+		info = rot->info + i;
+		ring_file_name(file, sizeof(file), dev, i);
+		fprintf(f, "%lu %u %u %lu %s %s\n", info->generation,
+			info->first_seq, info->last_seq, info->records,
+			ring_file_state_name[info->state], file);
+	}
+	if (fclose(f) || rename(tmp, name))
+		perror(name);
+}
+
+static void seal_ring_file(struct device* dev)
+{
+	struct rotation* rot = &dev->rotation;
+
+	if (dev->out < 0)
+		return;
+	if (fdatasync(dev->out) && errno != EINVAL)
+		fprintf(stderr, "%s: fdatasync: %m\n", dev->out_name);
+	close(dev->out);
+	dev->out = -1;
+	rot->info[rot->slot].state = RING_FILE_SEALED;
+	write_file_ring_index(dev);
+}
+
+static int open_ring_file(struct device* dev)
+{
+	struct rotation* rot = &dev->rotation;
+	struct ring_file* info;
+	char name[4096];
+
+	if (rot->generation)
+		rot->slot = (rot->slot + 1) % nr_ring_files;
+	ring_file_name(name, sizeof(name), dev, rot->slot);
+	/* truncating releases the blocks of the oldest file */
+	dev->out = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (dev->out < 0) {
+		perror(name);
+		return -1;
+	}
+	/* Allocate the whole file now, but keep its size at what was
+	 * written, so that readers see only records. */
+	if (fallocate(dev->out, FALLOC_FL_KEEP_SIZE, 0, ring_file_size) &&
+	    verbose)
+		fprintf(stderr, "%s: fallocate: %m\n", name);
+
+	info = rot->info + rot->slot;
+	info->generation = rot->generation++;
+	info->first_seq  = info->last_seq = 0;
+	info->records    = 0;
+	info->state      = RING_FILE_OPEN;
+	rot->fill = 0;
+	rot->partial_fill = 0;
+	write_file_ring_index(dev);
+	return 0;
+}
+
+static void note_record(struct ring_file* info, const struct timestamp* ts)
+{
+	if (!info->records++)
+		info->first_seq = ts->seq_no;
+	info->last_seq = ts->seq_no;
+}
+
+/* Note the sequence numbers of the records in data, which was just written
+ * to the current file. */
+static void index_records(struct rotation* rot, const char* data, size_t len)
+{
+	struct ring_file* info = rot->info + rot->slot;
+	const size_t rec = sizeof(struct timestamp);
+	size_t n;
+
+	if (rot->partial_fill) {
+		n = rec - rot->partial_fill;
+		if (n > len)
+			n = len;
+		memcpy(rot->partial + rot->partial_fill, data, n);
+		rot->partial_fill += n;
+		data += n;
+		len  -= n;
+		if (rot->partial_fill < rec)
+			return;
+		note_record(info, (const struct timestamp*) rot->partial);
+		rot->partial_fill = 0;
+	}
+	for (; len >= rec; data += rec, len -= rec)
+		note_record(info, (const struct timestamp*) data);
+	memcpy(rot->partial, data, len);
+	rot->partial_fill = len;
+}
+
+/* Write to the output of dev, moving on to the next file of the ring of
+ * files when the current one is full. */
+static ssize_t write_out(struct device* dev, const char* data, size_t len)
+{
+	struct rotation* rot = &dev->rotation;
+	ssize_t ret;
+
+	if (!nr_ring_files)
+		return write(dev->out, data, len);
+
+	if (dev->out < 0 && open_ring_file(dev))
+		return -1;
+	if (len > ring_file_size - rot->fill)
+		len = ring_file_size - rot->fill;
+	ret = write(dev->out, data, len);
+	if (ret > 0) {
+		index_records(rot, data, ret);
+		rot->fill += ret;
+		/* hand the file over as soon as it is complete */
+		if (rot->fill == ring_file_size)
+			seal_ring_file(dev);
+	}
+	return ret;
+}
+
+static size_t round_up_to_record(size_t bytes)
+{
+	return (bytes + sizeof(struct timestamp) - 1) /
+		sizeof(struct timestamp) * sizeof(struct timestamp);
+}
+
+/* Drop what lies more than flight_window bytes before the stream offset end
+ * (at most head), in whole records, so that a dump starts with one. */
+static void keep_window(struct ring* ring, size_t head, size_t* tail,
+			size_t end)
+{
+	const size_t rec = sizeof(struct timestamp);
+
+	if (end > head)
+		end = head;
+	if (end - *tail <= flight_window)
+		return;
+	*tail += (end - *tail - flight_window) / rec * rec;
+	__atomic_store_n(&ring->tail, *tail, __ATOMIC_RELEASE);
+}
+
+/* Flight recorder: returns the end of the data to write. If no dump is due,
+ * the data older than the window is dropped instead. */
+static size_t flight_until(struct ring* ring, size_t head, size_t* tail,
+			   size_t until, size_t* seen)
+{
+	size_t at;
+
+	/* a trigger is acted on once its record is published */
+	at = __atomic_load_n(&ring->trigger_at, __ATOMIC_ACQUIRE);
+	if (at != *seen && at - 1 <= head) {
+		*seen = at;
+		if (*tail >= until) {
+			ring->dumps++;
+			/* the dump starts a window before the trigger */
+			keep_window(ring, head, tail, at - 1);
+		}
+		until = round_up_to_record(at - 1 + post_trigger);
+	}
+	if (*tail >= until)
+		keep_window(ring, head, tail, head);
+	return until;
+}
+
+static void* ring_writer(void* arg)
+{
+	struct device* dev = arg;
+	struct ring* ring = &dev->ring;
+	size_t head, tail = 0, pos, len, end, until = 0, seen = 0;
+	ssize_t ret;
+	int done;
+
+	while (1) {
+		/* read done before head: no data may come after done */
+		done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		end  = head;
+		if (flight_window) {
+			until = flight_until(ring, head, &tail, until, &seen);
+			if (until < end)
+				end = until;
+			if (tail > end)
+				end = tail;
+		}
+		if (end == tail) {
+			if (done)
+				break;
+			usleep(RING_POLL_WRITER);
+			continue;
+		}
+		pos = tail % ring->size;
+		len = end - tail;
+		if (len > ring->size - pos)
+			len = ring->size - pos;
+		if (len > CHUNK_SIZE)
+			len = CHUNK_SIZE;
+		ret = write_out(dev, ring->buf + pos, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			fprintf(stderr, "%s: write: %m\n", dev->out_name ?
+				dev->out_name : "stdout");
+			__atomic_store_n(&ring->failed, 1, __ATOMIC_RELEASE);
+			break;
+		}
+		tail += ret;
+		ring->written += ret;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+	if (nr_ring_files)
+		seal_ring_file(dev);
+	return NULL;
+}
+
+static void raise_trigger(struct ring* ring, size_t at)
+{
+	size_t old = __atomic_load_n(&ring->trigger_at, __ATOMIC_RELAXED);
+
+	while (old < at + 1 &&
+	       !__atomic_compare_exchange_n(&ring->trigger_at, &old, at + 1, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+/* Start a dump on all devices. On dev, the post-trigger data begins after
+ * the triggering record, which ends at stream offset end; on the other
+ * devices, after the data they have published so far. */
+static void fire(struct device* dev, const struct timestamp* ts, size_t end,
+		 const char* what, uint64_t value, const char* unit)
+{
+	struct device* other;
+
+	for (other = devices; other < devices + nr_devices; other++)
+		raise_trigger(&other->ring, other == dev ? end :
+			      __atomic_load_n(&other->ring.head,
+					      __ATOMIC_ACQUIRE));
+	__atomic_add_fetch(&nr_triggers, 1, __ATOMIC_RELAXED);
+	if (verbose)
+		fprintf(stderr, "%s: trigger: %s of %llu %s (seq %u)\n",
+			dev->name, what, (unsigned long long) value, unit,
+			ts->seq_no);
+}
+
+/* Check the record that ends at stream offset end. */
+static void check_triggers(struct device* dev, const struct timestamp* ts,
+			   size_t end)
+{
+	struct pair_trigger* t;
+	uint64_t length;
+	int i;
+
+	if (latency_trigger && ts->event == TS_RELEASE_LATENCY &&
+	    ts_timestamp(ts) > latency_trigger)
+		fire(dev, ts, end, "RELEASE_LATENCY", ts_timestamp(ts), "ns");
+
+	for (i = 0; i < nr_pair_triggers; i++) {
+		t = pair_triggers + i;
+		if (ts->event == t->start) {
+			dev->started[i] = ts_timestamp(ts);
+			dev->open[i] = 1;
+		} else if (ts->event == t->end && dev->open[i]) {
+			dev->open[i] = 0;
+			length = ts_timestamp(ts) - dev->started[i];
+			if (!ts_irq_flag(ts) &&
+			    ts_timestamp(ts) > dev->started[i] &&
+			    length > t->cycles)
+				fire(dev, ts, end, t->name, length,
+				     "cycles");
+		}
+	}
+}
+
+/* Decode the records in the ring between the stream offsets from and to. */
+static size_t scan_records(struct device* dev, size_t from, size_t to)
+{
+	struct ring* ring = &dev->ring;
+
+	/* the ring size is a multiple of the record size, so no record
+	 * wraps around */
+	for (; from + sizeof(struct timestamp) <= to;
+	     from += sizeof(struct timestamp))
+		check_triggers(dev, (struct timestamp*)
+			       (ring->buf + from % ring->size),
+			       from + sizeof(struct timestamp));
+	return from;
+}
+
+/* Drain the device into the ring; the writer thread empties it. */
+static void cat_ring(struct device* dev)
 {
-	static char buf[4096];
-	int rd;
-	while ((rd = read(fd, buf, 4096)) > 0) {
-		total_bytes += rd;
-		fwrite(buf, 1, rd, stdout);
-		if (stop_after_bytes && total_bytes >= stop_after_bytes)
+	struct ring* ring = &dev->ring;
+	size_t head = 0, tail, pos, len, used, scanned = 0;
+	ssize_t rd;
+	int waiting = 0;
+
+	while (1) {
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		if (ring->size - (head - tail) < RING_MIN_READ) {
+			if (__atomic_load_n(&ring->failed, __ATOMIC_ACQUIRE))
+				break;
+			if (!waiting)
+				ring->full++;
+			waiting = 1;
+			usleep(RING_POLL_DRAIN);
+			continue;
+		}
+		waiting = 0;
+		pos = head % ring->size;
+		len = ring->size - (head - tail);
+		if (len > ring->size - pos)
+			len = ring->size - pos;
+		if (len > next_chunk(dev))
+			len = next_chunk(dev);
+		rd = read(dev->fd, ring->buf + pos, len);
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd <= 0)
+			break;
+		head += rd;
+		/* check before publishing, so that the writer cannot drop
+		 * records that were not checked yet */
+		if (flight_window)
+			scanned = scan_records(dev, scanned, head);
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+		used = head - tail;
+		if (used > ring->high_water)
+			ring->high_water = used;
+		if (done_after(dev, rd))
 			break;
 	}
+	__atomic_store_n(&ring->done, 1, __ATOMIC_RELEASE);
+}
+
+static int is_pipe(int fd)
+{
+	struct stat info;
+
+	return !fstat(fd, &info) && S_ISFIFO(info.st_mode);
+}
+
+/* Copy the device's data to its output. */
+static void cat(struct device* dev)
+{
+	enum copy_mode mode, fallback;
+	char* buf;
+
+	if (dev->ring.buf) {
+		cat_ring(dev);
+		if (verbose)
+			fprintf(stderr, "%s: copy mode: %s\n", dev->name,
+				copy_mode_name[COPY_RING]);
+		return;
+	}
+
+	if (posix_memalign((void**) &buf, sysconf(_SC_PAGESIZE), CHUNK_SIZE)) {
+		perror("posix_memalign");
+		return;
+	}
+
+	mode = is_pipe(dev->out) ? COPY_SPLICE_DIRECT : COPY_SPLICE;
+	if (force_read_write)
+		mode = COPY_READ_WRITE;
+	if (mode != COPY_READ_WRITE) {
+		fallback = cat_splice(dev, mode, buf);
+		if (fallback != mode && verbose)
+			fprintf(stderr, "%s: cannot splice, falling back to "
+				"%s.\n", dev->name, copy_mode_name[fallback]);
+		mode = fallback;
+	}
+	if (mode == COPY_READ_WRITE && !stopped(dev))
+		cat_read_write(dev, buf);
+	if (verbose)
+		fprintf(stderr, "%s: copy mode: %s\n", dev->name,
+			copy_mode_name[mode]);
+	free(buf);
+}
+
+static void* drain(void* arg)
+{
+	struct device* dev = arg;
+
+	if (dev->cpu >= 0 && be_migrate_to_cpu(dev->cpu))
+		fprintf(stderr, "%s: could not migrate to CPU %d (%m).\n",
+			dev->name, dev->cpu);
+	pthread_barrier_wait(&pinned);
+	/* a device without enabled events reads as empty */
+	pthread_barrier_wait(&enabled);
+
+	cat(dev);
+	if (stopped(dev))
+		disable_device(dev);
+	return NULL;
+}
+
+/* The CPU of the per-CPU devices in /dev/litmus, or -1. */
+static int device_cpu(const char* name)
+{
+	const char* base = strrchr(name, '/');
+	int cpu;
+	char tail;
+
+	base = base ? base + 1 : name;
+	if (sscanf(base, "ft_cpu_trace%d%c", &cpu, &tail) == 1 ||
+	    sscanf(base, "ft_msg_trace%d%c", &cpu, &tail) == 1)
+		return cpu;
+	return -1;
+}
+
+static int open_device(struct device* dev)
+{
+	dev->fd = open(dev->name, O_RDWR);
+	if (dev->fd < 0)
+		return -1;
+	/* A FIFO standing in for the device (e.g., for testing) must not be
+	 * held open for writing by us, or its end would never be seen. */
+	if (is_pipe(dev->fd)) {
+		close(dev->fd);
+		dev->fd = open(dev->name, O_RDONLY);
+	}
+	return dev->fd < 0 ? -1 : 0;
+}
+
+static int open_output(struct device* dev)
+{
+	if (nr_ring_files) {
+		/* the files are opened by the writer, as needed */
+		dev->out = -1;
+		dev->rotation.info = calloc(nr_ring_files,
+					    sizeof(struct ring_file));
+		return dev->rotation.info ? 0 : -1;
+	}
+	if (!dev->out_name) {
+		dev->out = STDOUT_FILENO;
+		return 0;
+	}
+	dev->out = open(dev->out_name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	return dev->out < 0 ? -1 : 0;
 }
 
 static void ping(const char* fname)
@@ -125,10 +891,27 @@ static void _usage(void)
 {
 	fprintf(stderr,
 		"Usage: ftcat [OPTIONS] <ft device> TS1 TS2 ....\n"
+		"       ftcat [OPTIONS] -o FILE <ft device> TS1 TS2 ... \\\n"
+		"                       [-o FILE <ft device> TS1 TS2 ...] ...\n"
 		"\nOptions:\n"
+		"   -o FILE   --  write the data of the following device to FILE\n"
+		"                 (required if there is more than one device)\n"
 		"   -s SIZE   --  stop tracing afer recording SIZE bytes\n"
 		"   -c        --  calibrate the CPU cycle counter offsets\n"
 		"   -p FILE   --  ping: write PID to FILE after initialization\n"
+		"   -b SIZE   --  buffer up to SIZE bytes per device between draining\n"
+		"                 and writing (default: 4 MB; 0: copy directly)\n"
+		"   -r        --  copy directly with read/write; do not try splice(2)\n"
+		"   -R N:SIZE --  write each device's data to a ring of N files of\n"
+		"                 SIZE bytes each (FILE.000, ...; see FILE.idx)\n"
+		"   -F SIZE   --  flight recorder: keep the last SIZE bytes per device\n"
+		"                 and write them only when a trigger fires (the\n"
+		"                 buffer is SIZE plus a margin, or -b if larger)\n"
+		"   -P SIZE   --  record SIZE bytes per device after a trigger\n"
+		"                 (default: as given with -F)\n"
+		"   -L NS     --  trigger on a RELEASE_LATENCY above NS nanoseconds\n"
+		"   -T EV=CYC --  trigger on an EV_START/EV_END pair longer than CYC\n"
+		"                 cycles (e.g., SCHED=100000; may be repeated)\n"
 		"   -v        --  enable verbose output\n"
 		"\n");
 	exit(1);
@@ -138,86 +921,268 @@ static void _usage(void)
 
 static void shutdown(int sig)
 {
-	int ok;
-	ok = disable_all(fd);
-	if (!ok)
-		fprintf(stderr, "disable_all: %m\n");
+	int i;
+
+	for (i = 0; i < nr_devices; i++)
+		disable_device(devices + i);
 }
 
-#define OPTSTR "s:cvp:"
+/* Options may be given before each device; stop at the first device. */
+#define OPTSTR "+s:cvp:rb:R:F:P:L:T:o:"
+
+static void add_pair_trigger(const char* arg)
+{
+	struct pair_trigger* t;
+	char name[64], start[80], end[80];
+	unsigned long long cycles;
+
+	if (nr_pair_triggers == MAX_TRIGGERS)
+		usage("too many triggers.");
+	t = pair_triggers + nr_pair_triggers;
+	if (sscanf(arg, "%63[^=]=%llu", name, &cycles) != 2 || !cycles)
+		usage("invalid trigger (%s)", arg);
+	snprintf(start, sizeof(start), "%s_START", name);
+	snprintf(end, sizeof(end), "%s_END", name);
+	if (!str2event(start, &t->start) || !str2event(end, &t->end))
+		usage("unknown event (%s)", name);
+	t->name   = strdup(name);
+	t->cycles = cycles;
+	nr_pair_triggers++;
+}
+
+static struct device* add_device(char* name, const char* out_name)
+{
+	struct device* dev;
+
+	devices = realloc(devices, (nr_devices + 1) * sizeof(*devices));
+	if (!devices) {
+		perror("realloc");
+		exit(1);
+	}
+	dev = devices + nr_devices++;
+	memset(dev, 0, sizeof(*dev));
+	dev->name     = name;
+	dev->out_name = out_name;
+	dev->cpu      = device_cpu(name);
+	return dev;
+}
 
 int main(int argc, char** argv)
 {
 	int opt;
 	int want_calibrate = 0;
+	int i, j;
+	unsigned long slack;
+	struct device* dev;
+	sigset_t signals, old_mask;
 
-	const char* trace_file;
+	const char* out_name = NULL;
 	const char* ping_file = NULL;
 
-	while ((opt = getopt(argc, argv, OPTSTR)) != -1) {
-		switch (opt) {
-		case 's':
-		        stop_after_bytes = atol(optarg);
-			if (stop_after_bytes == 0)
-				usage("invalid size (%s)", optarg);
-			break;
-		case 'c':
-			want_calibrate = 1;
-			break;
-		case 'v':
-			verbose = 1;
-			break;
-		case 'p':
-			ping_file = optarg;
-			break;
-		case ':':
-			usage("Argument missing.");
-			break;
-		case '?':
-		default:
-			usage("Bad argument.");
+	while (optind < argc) {
+		while ((opt = getopt(argc, argv, OPTSTR)) != -1) {
+			switch (opt) {
+			case 's':
+				stop_after_bytes = atol(optarg);
+				if (stop_after_bytes == 0)
+					usage("invalid size (%s)", optarg);
+				break;
+			case 'c':
+				want_calibrate = 1;
+				break;
+			case 'v':
+				verbose = 1;
+				break;
+			case 'p':
+				ping_file = optarg;
+				break;
+			case 'r':
+				force_read_write = 1;
+				break;
+			case 'b':
+				ring_size = atol(optarg);
+				break;
+			case 'R':
+				if (sscanf(optarg, "%u:%zu", &nr_ring_files,
+					   &ring_file_size) != 2 ||
+				    !nr_ring_files ||
+				    nr_ring_files > MAX_RING_FILES)
+					usage("invalid ring of files (%s)", optarg);
+				ring_file_size -= ring_file_size %
+					sizeof(struct timestamp);
+				if (ring_file_size < 4096)
+					usage("files of at least 4096 bytes required.");
+				break;
+			case 'F':
+				flight_window = atol(optarg);
+				if (flight_window == 0)
+					usage("invalid size (%s)", optarg);
+				break;
+			case 'P':
+				post_trigger = atol(optarg);
+				break;
+			case 'L':
+				latency_trigger = atoll(optarg);
+				if (latency_trigger == 0)
+					usage("invalid latency (%s)", optarg);
+				break;
+			case 'T':
+				add_pair_trigger(optarg);
+				break;
+			case 'o':
+				out_name = optarg;
+				break;
+			case ':':
+				usage("Argument missing.");
+				break;
+			case '?':
+			default:
+				usage("Bad argument.");
+				break;
+			}
+		}
+		if (optind >= argc)
 			break;
+		/* a device and its events, up to the next option */
+		dev = add_device(argv[optind++], out_name);
+		dev->events = argv + optind;
+		while (optind < argc && argv[optind][0] != '-') {
+			dev->nr_events++;
+			optind++;
 		}
+		if (dev->nr_events > MAX_EVENTS)
+			usage("too many events for %s", dev->name);
+		out_name = NULL;
 	}
 
-	argc -= optind;
-	argv += optind;
-
-	if (argc < 1)
+	if (nr_devices < 1)
 		usage("Argument missing.");
+	if (out_name)
+		usage("-o %s: no device given.", out_name);
+	for (i = 0; nr_devices > 1 && i < nr_devices; i++)
+		if (!devices[i].out_name)
+			usage("-o FILE required for %s.", devices[i].name);
+	if (flight_window) {
+		if (!latency_trigger && !nr_pair_triggers)
+			usage("-F requires a trigger (-L or -T).");
+		if (!post_trigger)
+			post_trigger = flight_window;
+		/* room to drain while the writer drops old data; a larger
+		 * ring (-b) leaves more room */
+		slack = flight_window / 4 > CHUNK_SIZE ?
+			flight_window / 4 : CHUNK_SIZE;
+		if (ring_size < flight_window + slack)
+			ring_size = flight_window + slack;
+	} else if (latency_trigger || nr_pair_triggers)
+		usage("triggers require -F.");
+	if (nr_ring_files) {
+		if (!ring_size)
+			usage("-R cannot be combined with -b 0.");
+		for (i = 0; i < nr_devices; i++)
+			if (!devices[i].out_name)
+				usage("-R requires -o FILE for %s.",
+				      devices[i].name);
+	}
 
-	trace_file = argv[0];
-	fd = open(trace_file, O_RDWR);
-	if (fd < 0) {
-		usage("could not open feathertrace device (%s): %m", trace_file);
-		return 1;
+	for (i = 0; i < nr_devices; i++) {
+		dev = devices + i;
+		if (open_device(dev)) {
+			usage("could not open feathertrace device (%s): %m", dev->name);
+			return 1;
+		}
+		if (open_output(dev)) {
+			fprintf(stderr, "Could not open %s: %m\n", dev->out_name);
+			return 1;
+		}
+		if (want_calibrate && !calibrate_cycle_offsets(dev->fd)) {
+			fprintf(stderr, "Calibrating %s failed: %m\n", dev->name);
+			return 3;
+		}
 	}
 
-	if (want_calibrate && !calibrate_cycle_offsets(fd)) {
-		fprintf(stderr, "Calibrating %s failed: %m\n", *argv);
-		return 3;
+	/* nothing may be buffered in stdio behind the drain threads' back */
+	fflush(stdout);
+
+	/* Only the main thread handles the shutdown signals; the drain
+	 * threads inherit the blocked mask. */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &old_mask);
+
+	pthread_barrier_init(&pinned, NULL, nr_devices + 1);
+	pthread_barrier_init(&enabled, NULL, nr_devices + 1);
+	for (i = 0; i < nr_devices; i++) {
+		dev = devices + i;
+		if (ring_size) {
+			init_ring(&dev->ring);
+			if (pthread_create(&dev->ring.writer, NULL,
+					   ring_writer, dev)) {
+				fprintf(stderr, "Could not start writer for "
+					"%s.\n", dev->name);
+				return 1;
+			}
+		}
+		if (pthread_create(&dev->thread, NULL, drain, dev)) {
+			fprintf(stderr, "Could not start thread for %s.\n",
+				dev->name);
+			return 1;
+		}
 	}
+	pthread_barrier_wait(&pinned);
 
-	argc -= 1;
-	argv += 1;
 	signal(SIGINT, shutdown);
 	signal(SIGUSR1, shutdown);
 	signal(SIGTERM, shutdown);
-	while (argc--) {
-		if (!enable_event(fd, *argv)) {
-			fprintf(stderr, "Enabling %s failed: %m\n", *argv);
-			return 2;
-		}
-		argv++;
+	for (i = 0; i < nr_devices; i++) {
+		dev = devices + i;
+		for (j = 0; j < dev->nr_events; j++)
+			if (!enable_event(dev, dev->events[j])) {
+				fprintf(stderr, "Enabling %s failed: %m\n",
+					dev->events[j]);
+				return 2;
+			}
 	}
+	/* a signal that arrived meanwhile disables all events now */
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
 	if (ping_file)
 		ping(ping_file);
+	pthread_barrier_wait(&enabled);
 
-	cat2stdout(fd);
-	close(fd);
-	fflush(stdout);
-	fprintf(stderr, "%s: %lu bytes read.\n", trace_file, total_bytes);
+	for (i = 0; i < nr_devices; i++) {
+		pthread_join(devices[i].thread, NULL);
+		if (devices[i].ring.buf)
+			pthread_join(devices[i].ring.writer, NULL);
+	}
+	for (i = 0; i < nr_devices; i++) {
+		dev = devices + i;
+		close(dev->fd);
+		if (dev->out_name && dev->out >= 0 && close(dev->out))
+			fprintf(stderr, "%s: %m\n", dev->out_name);
+		if (nr_ring_files)
+			fprintf(stderr, "%s: %lu files written, the last "
+				"one is %s.%03u (see %s.idx).\n", dev->name,
+				dev->rotation.generation, dev->out_name,
+				dev->rotation.slot, dev->out_name);
+		if (flight_window)
+			fprintf(stderr, "%s: %lu bytes read, %lu bytes written "
+				"in %lu dumps (full %lu times).\n",
+				dev->name, dev->total_bytes, dev->ring.written,
+				dev->ring.dumps, dev->ring.full);
+		else if (dev->ring.buf)
+			fprintf(stderr, "%s: %lu bytes read (buffered at most "
+				"%lu of %lu bytes, full %lu times).\n",
+				dev->name, dev->total_bytes,
+				(unsigned long) dev->ring.high_water,
+				(unsigned long) dev->ring.size,
+				dev->ring.full);
+		else
+			fprintf(stderr, "%s: %lu bytes read.\n", dev->name,
+				dev->total_bytes);
+	}
+	if (flight_window)
+		fprintf(stderr, "Triggers: %lu\n", nr_triggers);
 	return 0;
 }
-
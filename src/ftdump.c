@@ -21,8 +21,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "mapping.h"
+#include "decode.h"
+#include "segments.h"
 
 #include "timestamp.h"
 
@@ -42,25 +45,41 @@ static void dump(struct timestamp* ts, size_t count)
 			printf("%-20s seq:%u  pid:%u  timestamp:%llu  cpu:%d"
 			       "  type:%-8s irq:%u irqc:%02u \n",
 			       name,  x->seq_no,
-			       x->pid,
-			       (unsigned long long)  x->timestamp,
+			       ts_pid(x),
+			       (unsigned long long)  ts_timestamp(x),
 			       x->cpu,
-			       task_type2str(x->task_type),
-			       x->irq_flag,
-			       x->irq_count);
+			       task_type2str(ts_task_type(x)),
+			       ts_irq_flag(x),
+			       ts_irq_count(x));
 		else
 			printf("%16s:%3u seq:%u pid:%u  timestamp:%llu  cpu:%u"
 			       "  type:%-8s irq:%u irqc:%02u\n",
 			       "event",
-			       (unsigned int) x->event, x->seq_no, x->pid,
-			       (unsigned long long)  x->timestamp,
+			       (unsigned int) x->event, x->seq_no, ts_pid(x),
+			       (unsigned long long)  ts_timestamp(x),
 			       x->cpu,
-			       task_type2str(x->task_type),
-			       x->irq_flag,
-			       x->irq_count);
+			       task_type2str(ts_task_type(x)),
+			       ts_irq_flag(x),
+			       ts_irq_count(x));
 	}
 }
 
+static void dump_segments(const struct segment_index* idx)
+{
+	size_t i;
+
+	printf("segments: %lu\n", (unsigned long) idx->nr);
+	for (i = 0; i < idx->nr; i++)
+		printf("\t first:%llu  count:%llu  seq:%u\n",
+		       (unsigned long long) idx->segs[i].first,
+		       (unsigned long long) idx->segs[i].count,
+		       idx->segs[i].seq_no);
+}
+
+#define USAGE							\
+	"Usage: ftdump [-O ORDER] <logfile>\n"			\
+	"   -O: byte order          -- auto (default), native, or swapped\n"
+
 static void die(char* msg)
 {
 	if (errno)
@@ -69,6 +88,8 @@ static void die(char* msg)
 	exit(1);
 }
 
+#define OPTS "O:"
+
 #define offset(type, member)  ((unsigned long) &((type *) 0)->member)
 
 int main(int argc, char** argv)
@@ -76,6 +97,21 @@ int main(int argc, char** argv)
 	void* mapped;
 	size_t size, count;
 	struct timestamp* ts;
+	struct segment_index index;
+	enum trace_order order = TRACE_AUTO;
+	int opt;
+
+	while ((opt = getopt(argc, argv, OPTS)) != -1) {
+		switch (opt) {
+		case 'O':
+			if (parse_trace_order(optarg, &order))
+				die(USAGE);
+			break;
+		default:
+			die(USAGE);
+			break;
+		}
+	}
 
 	printf("struct timestamp:\n"
 	       "\t size              = %3lu\n"
@@ -87,13 +123,20 @@ int main(int argc, char** argv)
 	       offset(struct timestamp, cpu),
 	       offset(struct timestamp, event));
 
-	if (argc != 2)
-		die("Usage: ftdump  <logfile>");
-	if (map_file(argv[1], &mapped, &size))
+	if (argc - optind != 1)
+		die(USAGE);
+	if (map_file(argv[optind], &mapped, &size))
 		die("could not map file");
 
 	ts    = (struct timestamp*) mapped;
 	count = size / sizeof(struct timestamp);
+	/* the mapping is private */
+	if (ft_decode(ts, count, order))
+		printf("byte order: swapped\n");
+	if (!load_segment_index(argv[optind], ts, count, 0, &index)) {
+		dump_segments(&index);
+		free_segment_index(&index);
+	}
 
 	dump(ts, count);
 	return 0;
@@ -0,0 +1,437 @@
+/*    ftmerge -- Merge Feather-Trace files into one stream by sequence number.
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License along
+ *    with this program; if not, write to the Free Software Foundation, Inc.,
+ *    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "mapping.h"
+#include "outbuf.h"
+#include "decode.h"
+
+#include "timestamp.h"
+
+/* Sequence numbers are drawn from a single counter on all CPUs, so the
+ * per-device traces of one run interleave into a single sequence. Each input
+ * is expected to be (nearly) sorted: a record is put into order only if it is
+ * at most look_ahead records away from where it belongs in its own input.
+ *
+ * To order sequence numbers across an overflow, they are unwrapped into
+ * 64-bit keys, each relative to the previous record of the same input. */
+
+#define DEFAULT_LOOK_AHEAD 64
+#define MAX_LOOK_AHEAD     32768
+
+/* bytes of input consumed between releasing the pages behind the merge */
+#define RELEASE_CHUNK (16 * 1024 * 1024)
+
+#define EXHAUSTED UINT64_MAX
+
+/* Records are copied into the heap, so that the pages behind it can be
+ * released even if a record waits in the heap for long. */
+struct pending {
+	uint64_t key;
+	struct timestamp ts;
+};
+
+struct input {
+	const char* name;
+	struct timestamp* ts;
+	size_t count;
+	/* in the other byte order; converted as the records are read */
+	int swapped;
+	/* next record to enter the look-ahead heap */
+	size_t next;
+	/* key of the last record that entered it */
+	uint64_t last_key;
+	/* min-heap of the next records, by key */
+	struct pending* heap;
+	unsigned int nr_heap;
+	/* bytes at the start of the mapping that were handed back */
+	size_t released;
+
+	uint64_t merged;
+	uint64_t late;
+};
+
+static struct input* inputs;
+static unsigned int nr_inputs;
+static unsigned int look_ahead = DEFAULT_LOOK_AHEAD;
+
+/* Tournament (loser) tree over the inputs: tree[0] is the input with the
+ * smallest key, tree[1..nr_inputs) hold the losers of the matches played at
+ * the inner nodes. Leaf i sits at position nr_inputs + i. */
+static unsigned int* tree;
+
+static int want_verbose = 0;
+
+static uint64_t nr_holes = 0;
+static uint64_t nr_missing = 0;
+static uint64_t nr_duplicates = 0;
+static uint64_t nr_late = 0;
+
+/* wall-clock time in seconds */
+static double wctime(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + 1E-6 * tv.tv_usec);
+}
+
+static uint64_t unwrap(uint64_t ref, uint32_t seq_no)
+{
+	return ref + (int32_t) (seq_no - (uint32_t) ref);
+}
+
+static void heap_push(struct input* in, uint64_t key,
+		      const struct timestamp* ts)
+{
+	unsigned int pos = in->nr_heap++, parent;
+
+	while (pos) {
+		parent = (pos - 1) / 2;
+		if (in->heap[parent].key <= key)
+			break;
+		in->heap[pos] = in->heap[parent];
+		pos = parent;
+	}
+	in->heap[pos].key = key;
+	in->heap[pos].ts  = *ts;
+}
+
+static void heap_pop(struct input* in)
+{
+	struct pending last = in->heap[--in->nr_heap];
+	unsigned int pos = 0, child;
+
+	while ((child = 2 * pos + 1) < in->nr_heap) {
+		if (child + 1 < in->nr_heap &&
+		    in->heap[child + 1].key < in->heap[child].key)
+			child++;
+		if (last.key <= in->heap[child].key)
+			break;
+		in->heap[pos] = in->heap[child];
+		pos = child;
+	}
+	in->heap[pos] = last;
+}
+
+/* Move records from the mapping into the look-ahead heap until it is full. */
+static void refill(struct input* in)
+{
+	struct timestamp ts;
+
+	while (in->nr_heap < look_ahead && in->next < in->count) {
+		ts = in->ts[in->next++];
+		if (in->swapped)
+			ft_swap(&ts, 1);
+		in->last_key = unwrap(in->last_key, ts.seq_no);
+		heap_push(in, in->last_key, &ts);
+	}
+}
+
+static uint64_t head_key(unsigned int i)
+{
+	return inputs[i].nr_heap ? inputs[i].heap[0].key : EXHAUSTED;
+}
+
+/* Let the leaf of input i play its way up to the root. */
+static void replay(unsigned int i)
+{
+	unsigned int node = (nr_inputs + i) / 2, winner = i, tmp;
+	uint64_t key = head_key(i);
+
+	while (node) {
+		if (head_key(tree[node]) < key) {
+			tmp = tree[node];
+			tree[node] = winner;
+			winner = tmp;
+			key = head_key(winner);
+		}
+		node /= 2;
+	}
+	tree[0] = winner;
+}
+
+static unsigned int build(unsigned int node)
+{
+	unsigned int a, b;
+
+	if (node >= nr_inputs)
+		return node - nr_inputs;
+	a = build(2 * node);
+	b = build(2 * node + 1);
+	if (head_key(b) < head_key(a)) {
+		tree[node] = a;
+		return b;
+	}
+	tree[node] = b;
+	return a;
+}
+
+static void init_tree(void)
+{
+	tree = calloc(nr_inputs, sizeof(*tree));
+	if (!tree) {
+		perror("calloc");
+		exit(1);
+	}
+	tree[0] = nr_inputs > 1 ? build(1) : 0;
+}
+
+/* Hand the pages that were merged already back to the kernel; they are not
+ * needed again. The mapping is private, so this only discards our copy. */
+static void release_consumed(struct input* in)
+{
+	size_t upto = in->next * sizeof(struct timestamp);
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	upto -= upto % page_size;
+	if (upto - in->released < RELEASE_CHUNK)
+		return;
+	if (madvise((char*) in->ts + in->released, upto - in->released,
+		    MADV_DONTNEED))
+		perror("madvise");
+	in->released = upto;
+}
+
+static void note_gap(uint64_t last, uint64_t key, const struct input* in)
+{
+	if (key == last) {
+		nr_duplicates++;
+		if (want_verbose)
+			fprintf(stderr, "%s: duplicate seq_no %u\n",
+				in->name, (uint32_t) key);
+	} else if (key < last) {
+		nr_late++;
+		if (want_verbose)
+			fprintf(stderr, "%s: seq_no %u is too late "
+				"(%llu behind)\n", in->name, (uint32_t) key,
+				(unsigned long long) (last - key));
+	} else {
+		nr_holes++;
+		nr_missing += key - last - 1;
+		if (want_verbose)
+			fprintf(stderr, "hole: %llu records missing "
+				"before seq_no %u (%s)\n",
+				(unsigned long long) (key - last - 1),
+				(uint32_t) key, in->name);
+	}
+}
+
+static void merge(struct outbuf* out)
+{
+	struct input* in;
+	struct pending* head;
+	uint64_t last = 0;
+	int first = 1;
+
+	while (head_key(tree[0]) != EXHAUSTED) {
+		in = inputs + tree[0];
+		head = in->heap;
+		if (first)
+			first = 0;
+		else if (head->key != last + 1)
+			note_gap(last, head->key, in);
+		if (head->key < last)
+			in->late++;
+		else
+			last = head->key;
+		in->merged++;
+		outbuf_write(out, &head->ts, sizeof(struct timestamp));
+
+		heap_pop(in);
+		refill(in);
+		release_consumed(in);
+		replay(tree[0]);
+	}
+}
+
+static void open_inputs(char** names, enum trace_order order)
+{
+	struct input* in;
+	struct timestamp first;
+	void* mapped;
+	size_t size;
+	uint64_t ref = 0;
+	int have_ref = 0;
+	unsigned int i;
+
+	inputs = calloc(nr_inputs, sizeof(*inputs));
+	if (!inputs) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < nr_inputs; i++) {
+		in = inputs + i;
+		in->name = names[i];
+		if (map_file(in->name, &mapped, &size)) {
+			fprintf(stderr, "%s: could not map file\n", in->name);
+			exit(1);
+		}
+		in->ts    = mapped;
+		in->count = size / sizeof(struct timestamp);
+		in->swapped = ft_needs_swap(in->ts, in->count, order);
+		if (in->swapped && want_verbose)
+			fprintf(stderr, "%s: byte order: swapped\n", in->name);
+		in->heap = malloc(look_ahead * sizeof(*in->heap));
+		if (!in->heap) {
+			perror("malloc");
+			exit(1);
+		}
+		/* all inputs are unwrapped relative to the same record,
+		 * far enough from zero that they cannot go below it */
+		if (!have_ref && in->count) {
+			first = in->ts[0];
+			if (in->swapped)
+				ft_swap(&first, 1);
+			ref = (1ULL << 32) + first.seq_no;
+			have_ref = 1;
+		}
+	}
+	for (i = 0; i < nr_inputs; i++) {
+		inputs[i].last_key = ref;
+		refill(inputs + i);
+	}
+}
+
+static void report(double time)
+{
+	uint64_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < nr_inputs; i++) {
+		total += inputs[i].merged;
+		if (want_verbose)
+			fprintf(stderr, "%s: %llu records, %llu late\n",
+				inputs[i].name,
+				(unsigned long long) inputs[i].merged,
+				(unsigned long long) inputs[i].late);
+	}
+	fprintf(stderr,
+		"Inputs          : %10u\n"
+		"Total           : %10llu\n"
+		"Holes           : %10llu\n"
+		"Missing         : %10llu\n"
+		"Duplicates      : %10llu\n"
+		"Late            : %10llu\n"
+		"Size            : %10.2f Mb\n"
+		"Time            : %10.2f s\n"
+		"Throughput      : %10.2f Mb/s\n",
+		nr_inputs,
+		(unsigned long long) total,
+		(unsigned long long) nr_holes,
+		(unsigned long long) nr_missing,
+		(unsigned long long) nr_duplicates,
+		(unsigned long long) nr_late,
+		((double) total * sizeof(struct timestamp)) / 1024.0 / 1024.0,
+		time,
+		((double) total * sizeof(struct timestamp)) / 1024.0 / 1024.0
+		/ time);
+}
+
+#define USAGE							\
+	"Usage: ftmerge [-O ORDER] [-w RECORDS] [-v] [-o FILE] <logfile>...\n" \
+	"   -O: byte order          -- auto (default), native, or swapped\n" \
+	"   -w: look-ahead          -- records per input that may be out of\n" \
+	"                              order (default: 64)\n"	\
+	"   -v: verbose             -- list holes and late records\n" \
+	"   -o: output              -- write the merged trace to FILE\n" \
+	"                              (default: stdout)\n" \
+	"   -h: help                -- show this help message\n"
+
+static void die(char* msg)
+{
+	if (errno)
+		perror("error: ");
+	fprintf(stderr, "%s\n", msg);
+	fprintf(stderr, "%s", USAGE);
+	exit(1);
+}
+
+#define OPTS "O:w:vo:h"
+
+int main(int argc, char** argv)
+{
+	struct outbuf out;
+	enum trace_order order = TRACE_AUTO;
+	const char* out_file = NULL;
+	int fd = STDOUT_FILENO;
+	int opt;
+	double start, stop;
+
+	while ((opt = getopt(argc, argv, OPTS)) != -1) {
+		switch (opt) {
+		case 'O':
+			if (parse_trace_order(optarg, &order))
+				die("Bad argument -O.");
+			break;
+		case 'w':
+			look_ahead = atoi(optarg);
+			if (!look_ahead || look_ahead > MAX_LOOK_AHEAD)
+				die("Bad argument -w: need look-ahead of "
+				    "1 to 32768 records.");
+			break;
+		case 'v':
+			want_verbose = 1;
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'h':
+			fprintf(stderr, "%s", USAGE);
+			exit(0);
+		default:
+			die("Unknown option.");
+			break;
+		}
+	}
+
+	if (argc == optind)
+		die("arguments missing");
+	if (!out_file && isatty(STDOUT_FILENO))
+		die("refusing to write a binary trace to a terminal; use -o.");
+
+	start = wctime();
+
+	nr_inputs = argc - optind;
+	open_inputs(argv + optind, order);
+	init_tree();
+
+	if (out_file) {
+		fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0) {
+			perror(out_file);
+			exit(1);
+		}
+	}
+	outbuf_init(&out, fd);
+	merge(&out);
+	if (outbuf_release(&out) || (out_file && close(fd)))
+		die("could not write output");
+
+	stop = wctime();
+	report(stop - start);
+
+	return 0;
+}
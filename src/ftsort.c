@@ -24,27 +24,30 @@
 
 #include <errno.h>
 #include <unistd.h>
-#include <arpa/inet.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "mapping.h"
+#include "reorder.h"
+#include "outbuf.h"
+#include "decode.h"
+#include "segments.h"
 
 #include "timestamp.h"
 
-static unsigned int holes      = 0;
+static struct reorder_stats stats;
 static unsigned int non_monotonic = 0;
-static unsigned int reordered  = 0;
-static unsigned int aborted_moves = 0;
 static unsigned int implausible = 0;
 
 static int want_verbose = 0;
+/* where verbose messages go; stderr if the trace is written to stdout */
+static FILE* log_file;
 
 double cycles_per_nanosecond = 0;
 
-#define LOOK_AHEAD 1024
-#define MAX_NR_NOT_IN_RANGE 5
-
-#define MAX_CPUS UINT8_MAX
+#define MAX_CPUS (UINT8_MAX + 1)
 
 /* wall-clock time in seconds */
 double wctime(void)
@@ -54,11 +57,6 @@ double wctime(void)
 	return (tv.tv_sec + 1E-6 * tv.tv_usec);
 }
 
-static uint32_t next_seq_number(uint32_t seqno)
-{
-	return seqno + 1;
-}
-
 struct timestamp* find_forward_by_seq_no(struct timestamp* start,
 					 struct timestamp* end,
 					 uint32_t seq_no)
@@ -75,190 +73,239 @@ struct timestamp* find_forward_by_seq_no(struct timestamp* start,
 	return NULL;
 }
 
-static void mark_as_bad(struct timestamp *ts)
+/* Pages of the mapped trace that were modified in place. Only these are
+ * written back. */
+static char*    mapped_base;
+static size_t   mapped_size;
+static uint8_t* dirty_pages;
+static size_t   page_size;
+
+static void track_writes(void* base, size_t size)
 {
-	if (want_verbose)
-		printf("marking %s on cpu %u at %llu as bad\n",
-		       event2str(ts->event), ts->cpu,
-		       (unsigned long long) ts->timestamp);
-	ts->event = UINT8_MAX;
-	non_monotonic++;
+	mapped_base = base;
+	mapped_size = size;
+	page_size   = sysconf(_SC_PAGESIZE);
+	dirty_pages = calloc(size / page_size + 1, 1);
+	if (!dirty_pages) {
+		perror("calloc");
+		exit(1);
+	}
 }
 
-static int in_range(uint32_t seqno, uint32_t candidate)
+/* Records do not straddle pages. */
+static void written(struct timestamp *ts)
 {
-	uint32_t upper_bound = seqno + LOOK_AHEAD;
-	uint32_t diff        = candidate - seqno;
+	char* addr = (char*) ts;
 
-	return (upper_bound < seqno && candidate < seqno && candidate < upper_bound) ||
-		(candidate >= seqno && diff <  LOOK_AHEAD);
+	if (dirty_pages && addr >= mapped_base &&
+	    addr < mapped_base + mapped_size)
+		dirty_pages[(addr - mapped_base) / page_size] = 1;
 }
 
-#define OVERFLOW_CUTOFF ((int32_t)UINT16_MAX / 2)
-
-static int is_lower_seqno(int32_t candidate, int32_t min)
+/* Write back runs of dirty pages. Returns the number of bytes written. */
+static size_t write_back_dirty(void)
 {
-	/* compute difference in sequence numbers without overflow */
-	int64_t delta = (int64_t) min - (int64_t) candidate;
+	size_t nr_pages = (mapped_size + page_size - 1) / page_size;
+	size_t first, last, len, total = 0;
 
-	return (delta >= 0 && delta <= OVERFLOW_CUTOFF) ||
-		(delta < -OVERFLOW_CUTOFF);
+	for (first = 0; first < nr_pages; first = last) {
+		if (!dirty_pages[first]) {
+			last = first + 1;
+			continue;
+		}
+		for (last = first; last < nr_pages && dirty_pages[last]; last++)
+			;
+		len = (last - first) * page_size;
+		if (first * page_size + len > mapped_size)
+			len = mapped_size - first * page_size;
+		if (msync(mapped_base + first * page_size, len,
+			  MS_SYNC | MS_INVALIDATE))
+			perror("msync");
+		total += len;
+	}
+	return total;
 }
 
-struct timestamp* find_lowest_seq_no(struct timestamp* start,
-				     struct timestamp* end,
-				     uint32_t seqno)
-{
-	struct timestamp *pos, *min = NULL;
-	int nr_not_in_range = 0;
-
-	if (end > start + LOOK_AHEAD)
-		end = start + LOOK_AHEAD;
+/* Blocks in which an out-of-place result is written. */
+#define OUTPUT_BLOCK (4 * 1024 * 1024)
 
-	for (pos = start; pos != end && (!min || min->seq_no != seqno); pos++) {
-		/* pre-filter totally out-of-order samples */
-		if (in_range(seqno, pos->seq_no) &&
-		    (!min || is_lower_seqno(pos->seq_no, min->seq_no))) {
-			min = pos;
-		} else if (!in_range(seqno, pos->seq_no)) {
-			if (++nr_not_in_range > MAX_NR_NOT_IN_RANGE)
-				return NULL;
-		}
+static int write_output(const char* name, const char* data, size_t size)
+{
+	size_t done = 0, len;
+	ssize_t ret;
+	int fd;
+
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror(name);
+		return -1;
 	}
-	return min;
-}
-
-
-static void move_record(struct timestamp* target, struct timestamp* pos)
-{
-	struct timestamp tmp, *prev;
-
-	for (prev = target; prev < pos; prev++) {
-		/* Refuse to violate task and CPU sequentiality: since CPUs and
-		 * tasks execute sequentially, it makes no sense to move a
-		 * timestamp before something recorded by the same task or
-		 * CPU. Exception: TS_SEND_RESCHED_START is actually recorded
-		 * on a different CPU, so it is not subject to sequentiality
-		 * constraints.*/
-		if (prev->event != TS_SEND_RESCHED_START &&
-		    pos->event  != TS_SEND_RESCHED_START &&
-		    (prev->cpu == pos->cpu ||
-		     (prev->pid == pos->pid && pos->pid != 0))) {
-			/* Bail out before we cause more disturbance to the
-			 * stream. */
-			aborted_moves++;
-			if (want_verbose)
-				printf("Sequentiality constraint:\n"
-				       "\t<ev:%s seq:%u pid:%u cpu:%u at %llu>\n"
-				       "\tmust come before\n"
-				       "\t<ev:%s seq:%u pid:%u cpu:%u at %llu>\n",
-				       event2str(prev->event),
-				       prev->seq_no, prev->pid, prev->cpu,
-				       (unsigned long long) prev->timestamp,
-				       event2str(pos->event),
-				       pos->seq_no, pos->pid, pos->cpu,
-				       (unsigned long long) pos->timestamp);
-			return;
+	while (done < size) {
+		len = size - done < OUTPUT_BLOCK ? size - done : OUTPUT_BLOCK;
+		ret = write(fd, data + done, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			perror("write");
+			close(fd);
+			return -1;
 		}
+		done += ret;
 	}
+	return close(fd);
+}
 
-	while (pos > target) {
-		/* shift backwards */
-		prev = pos - 1;
+/* Incremental sorting (-a): the last two checked records of each CPU in the
+ * part of the trace sorted before are restored from the checkpoint as ghost
+ * records. If a ghost pos record turns out to be an outlier, the record is
+ * looked up among those that are sorted again: the ones held in the restored
+ * reorder window and the ones not pushed yet. */
+static struct timestamp  ghost_prev[MAX_CPUS];
+static struct timestamp  ghost_pos[MAX_CPUS];
+static struct timestamp *held_lo, *held_hi;
+static struct timestamp *unpushed_lo, *unpushed_hi;
+
+static struct timestamp* find_in(struct timestamp *ghost,
+				 struct timestamp *lo, struct timestamp *hi)
+{
+	for (; hi > lo; hi--)
+		if (!memcmp(hi - 1, ghost, sizeof(*ghost)))
+			return hi - 1;
+	return NULL;
+}
+
+static struct timestamp* find_ghost(struct timestamp *ghost)
+{
+	struct timestamp *ts = find_in(ghost, unpushed_lo, unpushed_hi);
 
-		tmp = *pos;
-		*pos = *prev;
-		*prev = tmp;
+	return ts ? ts : find_in(ghost, held_lo, held_hi);
+}
 
-		pos = prev;
+static void mark_as_bad(struct timestamp *ts)
+{
+	struct timestamp *ghost = ts;
+
+	if (ts >= ghost_pos && ts < ghost_pos + MAX_CPUS &&
+	    !(ts = find_ghost(ghost))) {
+		if (want_verbose)
+			fprintf(log_file, "too late to mark sample on cpu %u "
+				"at %llu as bad\n", ghost->cpu,
+				(unsigned long long) ts_timestamp(ghost));
+		return;
 	}
+	if (want_verbose)
+		fprintf(log_file, "marking %s on cpu %u at %llu as bad\n",
+		       event2str(ts->event), ts->cpu,
+		       (unsigned long long) ts_timestamp(ts));
+	ts->event = UINT8_MAX;
+	written(ts);
+	non_monotonic++;
+}
 
-	reordered++;
+/* Only timestamps of records subject to the monotonicity check are
+ * compared. */
+static int is_checked_event(uint8_t event)
+{
+	return event < SINGLE_RECORDS_RANGE && event != TS_SEND_RESCHED_START;
 }
 
-static void reorder(struct timestamp* start, struct timestamp* end)
+static int is_checked(struct timestamp *ts)
 {
-	struct timestamp* pos, *tmp;
-	uint32_t last_seqno = 0, expected_seqno;
+	return is_checked_event(ts->event);
+}
 
-	for (pos = start; pos != end;  pos++) {
-		/* check for for holes in the sequence number */
-		expected_seqno = next_seq_number(last_seqno);
-		if (pos != start && expected_seqno != pos->seq_no) {
-			tmp = find_lowest_seq_no(pos, end, expected_seqno);
+/* The monotonicity check reads the event, CPU, and timestamp of every
+ * record; it decodes them for a block of records at once. */
+#define CHECK_BLOCK 256
 
-			if (tmp && tmp != pos)
-				/* Good, we found next-best candidate. */
-				/* Move it to the right place. */
-				move_record(pos, tmp);
+struct check_block {
+	uint64_t timestamp[CHECK_BLOCK];
+	uint8_t  cpu[CHECK_BLOCK];
+	uint8_t  event[CHECK_BLOCK];
+};
 
-			/* check if the sequence number lines up now */
-			if (expected_seqno != pos->seq_no) {
-				/* bad, there's a hole here */
-				holes++;
-				if (want_verbose)
-					printf("HOLE: %u instead of %u\n",
-					       pos->seq_no,
-					       expected_seqno);
-			}
+/* Decode the block of records that starts at start. Returns its length. */
+static size_t unpack_check_block(struct check_block *b,
+				 struct timestamp *start,
+				 struct timestamp *end)
+{
+	struct ts_columns cols = {
+		.timestamp = b->timestamp,
+		.cpu       = b->cpu,
+		.event     = b->event,
+	};
+	size_t n = end - start < CHECK_BLOCK ? end - start : CHECK_BLOCK;
+
+	ts_unpack(start, n, &cols);
+	return n;
+}
 
-		}
-		last_seqno = pos->seq_no;
-	}
+/* Timestamps on each CPU should be monotonic. If there are "spikes" (high
+ * outliers) or "gaps" (low outliers), then the samples were disturbed by
+ * preemptions (not all samples are recorded with interrupts off). Samples
+ * disturbed in such ways create outliers; instead of filtering them later
+ * with statistical filters, we remove them while we can tell from context
+ * that they are anomalous observations. */
+static int is_outlier(uint64_t prev, uint64_t pos, uint64_t next)
+{
+	/* check for spikes  -^- */
+	if (prev < pos && pos >= next && prev < next)
+		return 1;
+	/* check for gaps -v- */
+	return prev >= pos && pos < next && prev < next;
 }
 
+/* The last two checked records of each CPU, in file order. */
+static struct timestamp *checked_prev[MAX_CPUS];
+static struct timestamp *checked_pos[MAX_CPUS];
+
 static void pre_check_cpu_monotonicity(struct timestamp *start,
 				       struct timestamp *end)
 {
-	struct timestamp *prev[MAX_CPUS];
-	struct timestamp *pos[MAX_CPUS];
+	struct timestamp **prev = checked_prev;
+	struct timestamp **pos  = checked_pos;
 	struct timestamp *next;
-	int i, outlier;
+	struct check_block b;
+	size_t i, n;
+	int outlier;
 	uint8_t cpu;
 
-	for (i = 0; i < MAX_CPUS; i++)
-		prev[i] = pos[i] = NULL;
-
-	for (next = start; next < end; next++) {
-		if (next->event >= SINGLE_RECORDS_RANGE ||
-		    next->event == TS_SEND_RESCHED_START)
-			continue;
-
-		outlier = 0;
-		cpu = next->cpu;
-
-		/* Timestamps on each CPU should be monotonic. If there are
-		 * "spikes" (high outliers) or "gaps" (low outliers), then the
-		 * samples were disturbed by preemptions (not all samples are
-		 * recorded with interrupts off). Samples disturbed in such
-		 * ways create outliers; instead of filtering them later with
-		 * statistical filters, we remove them while we can tell from
-		 * context that they are anomalous observations.*/
-		if (prev[cpu] && pos[cpu]) {
-			/* check for spikes  -^- */
-			if (prev[cpu]->timestamp < pos[cpu]->timestamp &&
-			    pos[cpu]->timestamp >= next->timestamp &&
-			    prev[cpu]->timestamp < next->timestamp) {
-				outlier = 1;
-			/* check for gaps -v- */
-			} else if (prev[cpu]->timestamp >= pos[cpu]->timestamp &&
-				   pos[cpu]->timestamp < next->timestamp &&
-				   prev[cpu]->timestamp < next->timestamp) {
-				outlier = 1;
+	for (; start < end; start += n) {
+		n = unpack_check_block(&b, start, end);
+		for (i = 0; i < n; i++) {
+			if (!is_checked_event(b.event[i]))
+				continue;
+
+			outlier = 0;
+			cpu  = b.cpu[i];
+			next = start + i;
+
+			if (prev[cpu] && pos[cpu])
+				outlier = is_outlier(ts_timestamp(prev[cpu]),
+						     ts_timestamp(pos[cpu]),
+						     b.timestamp[i]);
+			if (outlier) {
+				/* pos[cpu] is an anomalous sample */
+				mark_as_bad(pos[cpu]);
+				pos[cpu] = next;
+			} else {
+				prev[cpu] = pos[cpu];
+				pos[cpu] = next;
 			}
 		}
-		if (outlier) {
-			/* pos[cpu] is an anomalous sample */
-			mark_as_bad(pos[cpu]);
-			pos[cpu] = next;
-		} else {
-			prev[cpu] = pos[cpu];
-			pos[cpu] = next;
-		}
 	}
 }
 
 
+/* Scheduler invocations and releases on a CPU bound the end of the
+ * non-preemptable section in which a release latency was recorded. */
+static int is_np_upper_bound(uint8_t cpu, struct timestamp *ts)
+{
+	return ts->cpu == cpu &&
+		(ts->event == TS_RELEASE_START ||
+		 ts->event == TS_SCHED_START);
+}
+
 static struct timestamp*  find_np_upper_bound(
 	uint8_t cpu,
 	struct timestamp *start,
@@ -269,98 +316,938 @@ static struct timestamp*  find_np_upper_bound(
 	for (pos = start, prev = pos - 1;
 	     pos < end && prev->seq_no + 1 == pos->seq_no;
 	     pos++, prev = pos - 1) {
-		if (pos->cpu == cpu &&
-		    (pos->event == TS_RELEASE_START ||
-		     pos->event == TS_SCHED_START))
+		if (is_np_upper_bound(cpu, pos))
 			return pos;
 	}
 	return NULL;
 }
 
-static void filter_implausible_latencies(struct timestamp *start,
-					 struct timestamp *end)
+/* As find_np_upper_bound(), within a segment: there are no holes before
+ * end. */
+static struct timestamp* find_np_upper_bound_in_segment(
+	uint8_t cpu,
+	struct timestamp *start,
+	struct timestamp *end)
+{
+	struct timestamp *pos;
+
+	for (pos = start; pos < end; pos++)
+		if (is_np_upper_bound(cpu, pos))
+			return pos;
+	return NULL;
+}
+
+static uint64_t last_preemptable[MAX_CPUS];
+static int      lp_valid[MAX_CPUS];
+
+/* Does the record pos, followed by next, end the time during which the
+ * latency of a release on its CPU is plausible? */
+static int needs_np_upper_bound(struct timestamp *pos, struct timestamp *next)
+{
+	return pos->seq_no + 1 == next->seq_no &&
+		pos->event == TS_RELEASE_LATENCY && lp_valid[pos->cpu];
+}
+
+/* Is the release latency pos longer than its non-preemptable section, which
+ * started no earlier than last_preemptable and ended no later than bound? */
+static int is_implausible(struct timestamp *pos, struct timestamp *bound,
+			  uint64_t last_preemptable)
 {
-	uint64_t last_preemptable[MAX_CPUS];
 	uint64_t delta;
-	int      lp_valid[MAX_CPUS];
+
+	if (!bound || ts_timestamp(bound) <= last_preemptable)
+		return 0;
+	delta = ts_timestamp(bound) - last_preemptable;
+	return delta / cycles_per_nanosecond < ts_timestamp(pos);
+}
+
+static void mark_implausible(struct timestamp *pos, struct timestamp *bound,
+			     uint64_t last_preemptable)
+{
+	uint64_t delta = ts_timestamp(bound) - last_preemptable;
+
+	/* This makes no sense: more release latency than the upper bound on
+	 * the non-preemptable section length. */
+	pos->event = UINT8_MAX;
+	written(pos);
+	implausible++;
+	if (want_verbose)
+		fprintf(log_file,
+			"Latency %12lluns on cpu %u is implausible: "
+			"upper bound on non-preemptability = %10.0fns\n",
+			(unsigned long long) ts_timestamp(pos), pos->cpu,
+			delta / cycles_per_nanosecond);
+}
+
+/* Filter pos, which is followed by a hole or not, given the upper bound on
+ * the end of the non-preemptable section (if any) in which it was
+ * recorded. */
+static void filter_latency(struct timestamp *pos, int hole,
+			   struct timestamp *bound)
+{
 	int i;
 
-	struct timestamp *pos, *next;
+	/* In Linux, scheduler invocation can only start when a CPU is
+	 * preemptable. We use this to lower bound the time when a CPU
+	 * was last preemptable. */
+
+	/* reset at holes */
+	if (hole) {
+		for (i = 0; i < MAX_CPUS; i++)
+			lp_valid[i] = 0;
+	} else if (pos->event == TS_SCHED_START) {
+		lp_valid[pos->cpu] = 1;
+		last_preemptable[pos->cpu] = ts_timestamp(pos);
+	} else if (pos->event == TS_RELEASE_LATENCY) {
+		if (lp_valid[pos->cpu] &&
+		    is_implausible(pos, bound, last_preemptable[pos->cpu]))
+			mark_implausible(pos, bound, last_preemptable[pos->cpu]);
+	}
+}
 
-	for (i = 0; i < MAX_CPUS; i++)
-		lp_valid[i] = 0;
+/* Incremental sorting (-a): the filter state before this record is saved in
+ * the checkpoint. */
+static struct timestamp *lp_snapshot_at;
+static void save_lp_state(void);
+
+/* The segments of the sorted trace tell where the holes are, so records need
+ * not be checked one by one. */
+static void filter_implausible_latencies(struct timestamp *start,
+					 struct timestamp *from,
+					 struct timestamp *end,
+					 const struct segment_index *segs)
+{
+	struct timestamp *pos, *seg_end, *bound;
+	size_t i;
+
+	i = segs->nr ? segment_of(segs, from - start) - segs->segs : 0;
+	for (; i < segs->nr; i++) {
+		pos     = start + segs->segs[i].first;
+		seg_end = pos + segs->segs[i].count;
+		if (pos < from)
+			pos = from;
+		/* the last record is followed by a hole, if anything */
+		for (; pos < seg_end && pos + 1 < end; pos++) {
+			if (pos == lp_snapshot_at)
+				save_lp_state();
+			bound = NULL;
+			if (pos + 1 < seg_end &&
+			    pos->event == TS_RELEASE_LATENCY &&
+			    lp_valid[pos->cpu])
+				bound = find_np_upper_bound_in_segment(
+					pos->cpu, pos + 1, seg_end);
+			filter_latency(pos, pos + 1 == seg_end, bound);
+		}
+	}
+}
+
+/* Parallel checking and filtering.
+ *
+ * Both passes keep state per CPU only, so the trace is cut into chunks that
+ * worker threads process without knowing what precedes them. The main thread
+ * then carries the true per-CPU state from chunk to chunk in file order and
+ * applies the marks in the order in which a serial pass would make them:
+ *
+ *  - the monotonicity check of a chunk is redone for each CPU until its state
+ *    agrees with the worker's, after which every decision agrees, too;
+ *  - a release latency whose CPU state depends on earlier chunks is left to
+ *    the main thread, which knows that state once it gets to the chunk.
+ */
+
+static int nr_threads = 1;
+
+#define MIN_CHUNK_RECORDS (1 << 16)
+#define CHUNKS_PER_THREAD 4
+
+/* A record to mark as bad. For the monotonicity check, at is the record upon
+ * which it was decided; for latencies, at is the upper bound of the
+ * non-preemptable section, which started no earlier than last_preemptable. */
+struct mark {
+	struct timestamp *ts, *at;
+	uint64_t last_preemptable;
+};
+
+struct mark_list {
+	struct mark* marks;
+	size_t nr, size;
+};
+
+static void add_mark(struct mark_list* l, struct timestamp *ts,
+		     struct timestamp *at, uint64_t last_preemptable)
+{
+	if (l->nr == l->size) {
+		l->size = l->size ? 2 * l->size : 64;
+		l->marks = realloc(l->marks, l->size * sizeof(struct mark));
+		if (!l->marks) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	l->marks[l->nr].ts = ts;
+	l->marks[l->nr].at = at;
+	l->marks[l->nr].last_preemptable = last_preemptable;
+	l->nr++;
+}
+
+struct chunk_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+
+	char*  chunks;
+	size_t chunk_size;  /* in bytes */
+	size_t nr_chunks;
+	size_t next;
+	int*   done;
+
+	void (*work)(void* chunk);
+};
+
+static void* work_on_chunks(void* arg)
+{
+	struct chunk_pool* p = arg;
+	size_t i;
+
+	while (1) {
+		pthread_mutex_lock(&p->lock);
+		i = p->next < p->nr_chunks ? p->next++ : p->nr_chunks;
+		pthread_mutex_unlock(&p->lock);
+		if (i == p->nr_chunks)
+			break;
+
+		p->work(p->chunks + i * p->chunk_size);
+
+		pthread_mutex_lock(&p->lock);
+		p->done[i] = 1;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+	return NULL;
+}
 
-	for (pos = start, next = pos + 1; next < end; pos++, next = pos + 1) {
-		/* In Linux, scheduler invocation can only start when a CPU is
-		 * preemptable. We use this to lower bound the time when a CPU
-		 * was last preemptable. */
+/* Run work on each chunk on nr_threads threads and merge the chunks in order
+ * on the calling thread as soon as they are done. */
+static void run_chunks(void* chunks, size_t chunk_size, size_t nr_chunks,
+		       void (*work)(void* chunk), void (*merge)(void* chunk))
+{
+	struct chunk_pool p;
+	pthread_t* threads;
+	size_t i;
+	int t;
+
+	memset(&p, 0, sizeof(p));
+	p.chunks     = chunks;
+	p.chunk_size = chunk_size;
+	p.nr_chunks  = nr_chunks;
+	p.work       = work;
+	p.done       = calloc(nr_chunks, sizeof(int));
+	threads      = calloc(nr_threads, sizeof(pthread_t));
+	if (!p.done || !threads) {
+		perror("calloc");
+		exit(1);
+	}
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.cond, NULL);
+
+	for (t = 0; t < nr_threads; t++)
+		if (pthread_create(threads + t, NULL, work_on_chunks, &p)) {
+			perror("pthread_create");
+			exit(1);
+		}
+
+	for (i = 0; i < nr_chunks; i++) {
+		pthread_mutex_lock(&p.lock);
+		while (!p.done[i])
+			pthread_cond_wait(&p.cond, &p.lock);
+		pthread_mutex_unlock(&p.lock);
+		merge(p.chunks + i * chunk_size);
+	}
+
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+	pthread_mutex_destroy(&p.lock);
+	pthread_cond_destroy(&p.cond);
+	free(threads);
+	free(p.done);
+}
+
+static size_t nr_chunks_for(size_t count, size_t* chunk_records)
+{
+	*chunk_records = count / (CHUNKS_PER_THREAD * nr_threads);
+	if (*chunk_records < MIN_CHUNK_RECORDS)
+		*chunk_records = MIN_CHUNK_RECORDS;
+	return (count + *chunk_records - 1) / *chunk_records;
+}
+
+struct check_chunk {
+	struct timestamp *lo, *hi;
+	/* marks in the order decided, and the final state, if nothing
+	 * preceded the chunk */
+	struct mark_list marks;
+	struct timestamp *prev[MAX_CPUS];
+	struct timestamp *pos[MAX_CPUS];
+};
+
+static void check_chunk(void* arg)
+{
+	struct check_chunk* c = arg;
+	struct timestamp *start, *next;
+	struct check_block b;
+	size_t i, n;
+	uint8_t cpu;
+
+	for (start = c->lo; start < c->hi; start += n) {
+		n = unpack_check_block(&b, start, c->hi);
+		for (i = 0; i < n; i++) {
+			if (!is_checked_event(b.event[i]))
+				continue;
+			cpu  = b.cpu[i];
+			next = start + i;
+			if (c->prev[cpu] && c->pos[cpu] &&
+			    is_outlier(ts_timestamp(c->prev[cpu]),
+				       ts_timestamp(c->pos[cpu]),
+				       b.timestamp[i]))
+				add_mark(&c->marks, c->pos[cpu], next, 0);
+			else
+				c->prev[cpu] = c->pos[cpu];
+			c->pos[cpu] = next;
+		}
+	}
+}
+
+static void merge_check_chunk(void* arg)
+{
+	struct check_chunk* c = arg;
+	struct timestamp *spec_prev[MAX_CPUS], *spec_pos[MAX_CPUS], *next;
+	struct mark_list fixed = {NULL, 0, 0};
+	struct mark* spec = c->marks.marks;
+	size_t i = 0, j = 0;
+	int pending[MAX_CPUS], nr_pending = 0, cpu;
+
+	/* CPUs without history start out in agreement with the worker */
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		spec_prev[cpu] = spec_pos[cpu] = NULL;
+		pending[cpu] = checked_pos[cpu] && c->pos[cpu];
+		nr_pending += pending[cpu];
+	}
+
+	for (next = c->lo; nr_pending && next < c->hi; next++) {
+		if (!is_checked(next))
+			continue;
+		while (i < c->marks.nr && spec[i].at < next)
+			i++;
+		cpu = next->cpu;
+		if (!pending[cpu])
+			continue;
+
+		/* the worker's decision at next does not count */
+		if (i < c->marks.nr && spec[i].at == next)
+			spec[i].ts = NULL;
+		else
+			spec_prev[cpu] = spec_pos[cpu];
+		spec_pos[cpu] = next;
+
+		if (checked_prev[cpu] &&
+		    is_outlier(ts_timestamp(checked_prev[cpu]),
+			       ts_timestamp(checked_pos[cpu]),
+			       ts_timestamp(next)))
+			add_mark(&fixed, checked_pos[cpu], next, 0);
+		else
+			checked_prev[cpu] = checked_pos[cpu];
+		checked_pos[cpu] = next;
+
+		if (checked_prev[cpu] == spec_prev[cpu] ||
+		    next == c->pos[cpu]) {
+			pending[cpu] = 0;
+			nr_pending--;
+		}
+	}
 
-		/* reset at holes */
+	/* From where the states agree, the worker's state is the true one. */
+	for (cpu = 0; cpu < MAX_CPUS; cpu++)
+		if (c->pos[cpu] && checked_pos[cpu] != c->pos[cpu]) {
+			checked_prev[cpu] = c->prev[cpu];
+			checked_pos[cpu]  = c->pos[cpu];
+		}
+
+	/* apply both lists in the order decided */
+	i = 0;
+	while (i < c->marks.nr || j < fixed.nr) {
+		if (j == fixed.nr ||
+		    (i < c->marks.nr && spec[i].at < fixed.marks[j].at)) {
+			if (spec[i].ts)
+				mark_as_bad(spec[i].ts);
+			i++;
+		} else
+			mark_as_bad(fixed.marks[j++].ts);
+	}
+	free(fixed.marks);
+	free(c->marks.marks);
+}
+
+static void pre_check_cpu_monotonicity_parallel(struct timestamp *start,
+						struct timestamp *end)
+{
+	struct check_chunk* chunks;
+	size_t i, n, chunk_records;
+
+	n = nr_chunks_for(end - start, &chunk_records);
+	chunks = calloc(n, sizeof(struct check_chunk));
+	if (!chunks) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		chunks[i].lo = start + i * chunk_records;
+		chunks[i].hi = i + 1 < n ? chunks[i].lo + chunk_records : end;
+	}
+	run_chunks(chunks, sizeof(struct check_chunk), n,
+		   check_chunk, merge_check_chunk);
+	free(chunks);
+}
+
+enum { LP_UNKNOWN = 0, LP_INVALID, LP_VALID };
+
+struct filter_chunk {
+	/* records followed by another one, and the end of the trace */
+	struct timestamp *lo, *hi, *end;
+	struct mark_list marks;
+	/* latencies on CPUs of unknown state, in file order */
+	struct mark_list pending;
+	/* state at the end of the chunk; unknown unless set in it */
+	int      hole;
+	uint8_t  state[MAX_CPUS];
+	uint64_t last_preemptable[MAX_CPUS];
+};
+
+static void filter_chunk(void* arg)
+{
+	struct filter_chunk* c = arg;
+	struct timestamp *pos, *next, *bound;
+	int i;
+
+	for (pos = c->lo, next = pos + 1; pos < c->hi; pos++, next = pos + 1) {
 		if (pos->seq_no + 1 != next->seq_no) {
+			c->hole = 1;
 			for (i = 0; i < MAX_CPUS; i++)
-				lp_valid[i] = 0;
+				c->state[i] = LP_INVALID;
 		} else if (pos->event == TS_SCHED_START) {
-			lp_valid[pos->cpu] = 1;
-			last_preemptable[pos->cpu] = pos->timestamp;
+			c->state[pos->cpu] = LP_VALID;
+			c->last_preemptable[pos->cpu] = ts_timestamp(pos);
 		} else if (pos->event == TS_RELEASE_LATENCY) {
-			if (lp_valid[pos->cpu] &&
-			    (next = find_np_upper_bound(pos->cpu, next, end)) &&
-			    next->timestamp > last_preemptable[pos->cpu]) {
-				delta = next->timestamp - last_preemptable[pos->cpu];
-				if (delta / cycles_per_nanosecond < pos->timestamp) {
-					/* This makes no sense: more release latency than the
-					 * upper bound on the non-preemptable section length.
-					 */
-					pos->event = UINT8_MAX;
-					implausible++;
-					if (want_verbose)
-						printf("Latency %12lluns on cpu %u is implausible: "
-						       "upper bound on non-preemptability = %10.0fns\n",
-						       (unsigned long long) pos->timestamp, pos->cpu,
-						       delta / cycles_per_nanosecond);
+			if (c->state[pos->cpu] == LP_UNKNOWN)
+				add_mark(&c->pending, pos, NULL, 0);
+			else if (c->state[pos->cpu] == LP_VALID) {
+				bound = find_np_upper_bound(pos->cpu, next,
+							    c->end);
+				if (is_implausible(pos, bound,
+						   c->last_preemptable[pos->cpu]))
+					add_mark(&c->marks, pos, bound,
+						 c->last_preemptable[pos->cpu]);
+			}
+		}
+	}
+}
+
+static void merge_filter_chunk(void* arg)
+{
+	struct filter_chunk* c = arg;
+	struct mark_list resolved = {NULL, 0, 0};
+	struct mark *m = c->marks.marks, *r;
+	struct timestamp *pos, *bound;
+	size_t i, j = 0;
+
+	/* the state of these CPUs was carried over from earlier chunks */
+	for (i = 0; i < c->pending.nr; i++) {
+		pos = c->pending.marks[i].ts;
+		if (!lp_valid[pos->cpu])
+			continue;
+		bound = find_np_upper_bound(pos->cpu, pos + 1, c->end);
+		if (is_implausible(pos, bound, last_preemptable[pos->cpu]))
+			add_mark(&resolved, pos, bound,
+				 last_preemptable[pos->cpu]);
+	}
+
+	for (i = 0; i < MAX_CPUS; i++)
+		if (c->hole || c->state[i] != LP_UNKNOWN) {
+			lp_valid[i] = c->state[i] == LP_VALID;
+			last_preemptable[i] = c->last_preemptable[i];
+		}
+
+	/* apply both lists in file order */
+	r = resolved.marks;
+	for (i = 0; i < c->marks.nr || j < resolved.nr; ) {
+		if (j == resolved.nr || (i < c->marks.nr && m[i].ts < r[j].ts)) {
+			mark_implausible(m[i].ts, m[i].at,
+					 m[i].last_preemptable);
+			i++;
+		} else {
+			mark_implausible(r[j].ts, r[j].at,
+					 r[j].last_preemptable);
+			j++;
+		}
+	}
+	free(resolved.marks);
+	free(c->marks.marks);
+	free(c->pending.marks);
+}
+
+static void filter_implausible_latencies_parallel(struct timestamp *start,
+						  struct timestamp *end)
+{
+	struct filter_chunk* chunks;
+	size_t i, n, chunk_records;
+
+	/* the last record is followed by none */
+	n = nr_chunks_for(end - start - 1, &chunk_records);
+	chunks = calloc(n, sizeof(struct filter_chunk));
+	if (!chunks) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		chunks[i].lo  = start + i * chunk_records;
+		chunks[i].hi  = i + 1 < n ? chunks[i].lo + chunk_records : end - 1;
+		chunks[i].end = end;
+	}
+	run_chunks(chunks, sizeof(struct filter_chunk), n,
+		   filter_chunk, merge_filter_chunk);
+	free(chunks);
+}
+
+/* Streaming mode: records are read from stdin and pass through the same
+ * stages as a mapped file, but each stage holds back only as many records as
+ * it needs to decide about them:
+ *
+ *  - a record subject to the monotonicity check is held until the next
+ *    checked record of the same CPU, in file order;
+ *  - the reorder window holds as many records as it currently spans;
+ *  - a release latency is held until the next scheduler invocation or
+ *    release on its CPU, or the next hole, in sequence-number order.
+ *
+ * The first and last stages hold at most STREAM_DELAY records. Beyond that,
+ * the oldest record is passed on as if no later record could change it, which
+ * differs from sorting a file only if a CPU records nothing for that long.
+ */
+#define STREAM_DELAY (64 * LOOK_AHEAD)
+
+struct record_fifo {
+	struct timestamp buf[STREAM_DELAY];
+	uint64_t head;
+	uint64_t tail;
+};
+
+static struct timestamp* fifo_at(struct record_fifo* f, uint64_t idx)
+{
+	return f->buf + idx % STREAM_DELAY;
+}
+
+static int fifo_full(struct record_fifo* f)
+{
+	return f->tail - f->head == STREAM_DELAY;
+}
+
+/* records in file order awaiting the monotonicity check */
+static struct record_fifo unchecked;
+static struct {
+	uint64_t prev, pos;  /* timestamps */
+	uint64_t pos_idx;    /* index of pos in unchecked */
+	int nr;              /* number of valid timestamps */
+} cpu_state[MAX_CPUS];
+
+/* sorted records awaiting the latency filter */
+static struct record_fifo unfiltered;
+static uint64_t next_unfiltered;
+
+static struct reorder_window window;
+static struct outbuf out;
+static size_t stream_count;
+
+static void emit(struct timestamp* ts)
+{
+	outbuf_write(&out, ts, sizeof(*ts));
+}
+
+/* Pass on sorted records once the latency filter is done with them. */
+static void filter_stream(int at_end)
+{
+	struct timestamp *pos, *next, *bound;
+	uint64_t idx;
+
+	for (; next_unfiltered + 1 < unfiltered.tail; next_unfiltered++) {
+		pos   = fifo_at(&unfiltered, next_unfiltered);
+		next  = fifo_at(&unfiltered, next_unfiltered + 1);
+		bound = NULL;
+		if (needs_np_upper_bound(pos, next)) {
+			/* as find_np_upper_bound() */
+			for (idx = next_unfiltered + 1; idx < unfiltered.tail;
+			     idx++) {
+				bound = fifo_at(&unfiltered, idx);
+				if (fifo_at(&unfiltered, idx - 1)->seq_no + 1
+				    != bound->seq_no) {
+					bound = NULL;
+					break;
 				}
+				if (is_np_upper_bound(pos->cpu, bound))
+					break;
+			}
+			if (idx == unfiltered.tail) {
+				/* wait for the rest of the section */
+				if (!at_end && !fifo_full(&unfiltered))
+					break;
+				bound = NULL;
 			}
 		}
+		filter_latency(pos, pos->seq_no + 1 != next->seq_no, bound);
+		emit(pos);
+		unfiltered.head++;
 	}
+	if (at_end)
+		while (unfiltered.head < unfiltered.tail)
+			emit(fifo_at(&unfiltered, unfiltered.head++));
 }
 
-static inline uint64_t bget(int x, uint64_t quad)
+static void sorted(struct timestamp* ts)
+{
+	if (!cycles_per_nanosecond) {
+		emit(ts);
+		return;
+	}
+	*fifo_at(&unfiltered, unfiltered.tail++) = *ts;
+	filter_stream(0);
+}
 
+static void reorder_stream_record(struct timestamp* ts)
 {
-	return (((0xffll << 8 * x) & quad) >> 8 * x);
+	struct timestamp tmp;
+
+	reorder_push(&window, ts);
+	while (reorder_window_full(&window) && reorder_pop(&window, &tmp))
+		sorted(&tmp);
 }
 
-static inline uint64_t bput(uint64_t b, int pos)
+static int is_pending(uint64_t idx)
 {
-	return (b << 8 * pos);
+	struct timestamp* ts = fifo_at(&unchecked, idx);
+
+	return is_checked(ts) && cpu_state[ts->cpu].nr &&
+		cpu_state[ts->cpu].pos_idx == idx;
+}
+
+static void check_stream_record(uint64_t idx)
+{
+	struct timestamp* next = fifo_at(&unchecked, idx);
+	uint8_t cpu = next->cpu;
+
+	if (!is_checked(next))
+		return;
+
+	if (cpu_state[cpu].nr == 2 &&
+	    is_outlier(cpu_state[cpu].prev, cpu_state[cpu].pos,
+		       ts_timestamp(next))) {
+		/* pos is an anomalous sample */
+		if (cpu_state[cpu].pos_idx >= unchecked.head)
+			mark_as_bad(fifo_at(&unchecked, cpu_state[cpu].pos_idx));
+		else if (want_verbose)
+			fprintf(log_file, "too late to mark sample on cpu %u "
+				"at %llu as bad\n", cpu,
+				(unsigned long long) cpu_state[cpu].pos);
+	} else {
+		cpu_state[cpu].prev = cpu_state[cpu].pos;
+		if (cpu_state[cpu].nr < 2)
+			cpu_state[cpu].nr++;
+	}
+	cpu_state[cpu].pos     = ts_timestamp(next);
+	cpu_state[cpu].pos_idx = idx;
 }
 
-static inline uint64_t ntohx(uint64_t q)
+static void stream_record(struct timestamp* ts)
 {
-	return (bput(bget(0, q), 7) | bput(bget(1, q), 6) |
-		bput(bget(2, q), 5) | bput(bget(3, q), 4) |
-		bput(bget(4, q), 3) | bput(bget(5, q), 2) |
-		bput(bget(6, q), 1) | bput(bget(7, q), 0));
+	while (unchecked.head < unchecked.tail &&
+	       (fifo_full(&unchecked) || !is_pending(unchecked.head)))
+		reorder_stream_record(fifo_at(&unchecked, unchecked.head++));
+
+	*fifo_at(&unchecked, unchecked.tail) = *ts;
+	check_stream_record(unchecked.tail++);
+	stream_count++;
 }
 
-static void restore_byte_order(struct timestamp* start, struct timestamp* end)
+static void sort_stream(int in, int swap_byte_order, unsigned int look_ahead)
 {
-	struct timestamp* pos = start;
-	while (pos !=end) {
-		pos->timestamp = ntohx(pos->timestamp);
-		pos->seq_no    = ntohl(pos->seq_no);
-		pos++;
+	struct timestamp buf[LOOK_AHEAD], tmp;
+	size_t fill = 0, i, n;
+	ssize_t ret;
+
+	init_reorder_window(&window, &stats, want_verbose ? log_file : NULL);
+	if (look_ahead)
+		fix_reorder_window(&window, look_ahead);
+	outbuf_init(&out, STDOUT_FILENO);
+
+	while ((ret = read(in, (char*) buf + fill, sizeof(buf) - fill))) {
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			break;
+		}
+		fill += ret;
+		n = fill / sizeof(struct timestamp);
+		if (swap_byte_order)
+			ft_swap(buf, n);
+		for (i = 0; i < n; i++)
+			stream_record(buf + i);
+		/* keep a partial record */
+		fill -= n * sizeof(struct timestamp);
+		memmove(buf, buf + n, fill);
 	}
+
+	while (unchecked.head < unchecked.tail)
+		reorder_stream_record(fifo_at(&unchecked, unchecked.head++));
+	while (reorder_pop(&window, &tmp))
+		sorted(&tmp);
+	if (cycles_per_nanosecond)
+		filter_stream(1);
+
+	if (outbuf_release(&out))
+		perror("write");
+	free_reorder_window(&window);
+}
+
+/* Incremental sorting (-a).
+ *
+ * After sorting, a checkpoint is stored next to the trace, in <trace>.ckpt.
+ * When the trace has grown by the next run, only the records from the resume
+ * point on are sorted again: the overlap, which consists of the last records
+ * sorted before and is as long as the largest reorder window, and the
+ * appended tail. Appended records that belong before the old end of the trace
+ * are thus moved back as in a complete sort.
+ *
+ * To continue exactly where a complete sort would be, the checkpoint holds
+ * the state of the reorder window right before the record at the resume point
+ * was popped, including the records held in it, and the records that had not
+ * been pushed yet (which are overwritten in the trace). The monotonicity
+ * check continues in file order at the old end of the trace, with the last
+ * two checked records of each CPU, and the latency filter continues at the
+ * record before the resume point, with the state saved in the checkpoint.
+ *
+ * The result differs from that of sorting the whole file only if an outlier
+ * found in the tail was pushed before the resume point, or if appended
+ * records end a non-preemptable section that began before it.
+ */
+
+#define CHECKPOINT_MAGIC   "FTCKPT\0"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_EXT     ".ckpt"
+
+/* the latency filter state is valid */
+#define CKPT_HAVE_LP 0x1
+
+/* Followed by the records from the resume point to the end of the trace, as
+ * they were before the resume point was popped: the held records, in slot
+ * order, and the records not yet pushed. */
+struct sort_checkpoint {
+	char     magic[8];
+	uint32_t version;
+	uint32_t flags;
+	/* records sorted, the last of them, and where to sort again */
+	uint64_t nr_records;
+	uint64_t resume;
+	struct timestamp last;
+	struct reorder_snapshot window;
+
+	/* monotonicity check at the end of the file order */
+	uint8_t  nr_checked[MAX_CPUS];
+	struct timestamp prev[MAX_CPUS];
+	struct timestamp pos[MAX_CPUS];
+
+	/* latency filter before record resume - 1 */
+	uint8_t  lp_valid[MAX_CPUS];
+	uint64_t last_preemptable[MAX_CPUS];
+};
+
+static struct sort_checkpoint ckpt;
+static struct timestamp* ckpt_pending;
+static int ckpt_taken;
+/* end of the trace being sorted */
+static struct timestamp* trace_end;
+
+static void save_lp_state(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		ckpt.lp_valid[i] = lp_valid[i];
+		ckpt.last_preemptable[i] = last_preemptable[i];
+	}
+	ckpt.flags |= CKPT_HAVE_LP;
+}
+
+static void save_check_state(void)
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		ckpt.nr_checked[i] = !!checked_pos[i] + !!checked_prev[i];
+		if (checked_prev[i])
+			ckpt.prev[i] = *checked_prev[i];
+		if (checked_pos[i])
+			ckpt.pos[i] = *checked_pos[i];
+	}
+}
+
+/* Called by reorder_through() at the resume point of the next run. */
+static void save_window(struct reorder_window* w, struct timestamp* in)
+{
+	size_t nr_raw = trace_end - in;
+
+	free(ckpt_pending);
+	ckpt_pending = malloc((w->nr_held + nr_raw) * sizeof(*in));
+	if (!ckpt_pending) {
+		perror("malloc");
+		exit(1);
+	}
+	reorder_save(w, &ckpt.window, ckpt_pending);
+	memcpy(ckpt_pending + w->nr_held, in, nr_raw * sizeof(*in));
+	ckpt_taken = 1;
+}
+
+static void restore_state(const struct sort_checkpoint* c)
+{
+	int i;
+
+	for (i = 0; i < MAX_CPUS; i++) {
+		ghost_prev[i] = c->prev[i];
+		ghost_pos[i]  = c->pos[i];
+		checked_prev[i] = c->nr_checked[i] == 2 ? ghost_prev + i : NULL;
+		checked_pos[i]  = c->nr_checked[i] ? ghost_pos + i : NULL;
+		if (c->flags & CKPT_HAVE_LP) {
+			lp_valid[i] = c->lp_valid[i];
+			last_preemptable[i] = c->last_preemptable[i];
+		}
+	}
+}
+
+static void checkpoint_name(char* buf, size_t len, const char* trace)
+{
+	snprintf(buf, len, "%s%s", trace, CHECKPOINT_EXT);
+}
+
+/* Load the checkpoint of the trace and the pending records, unless it does
+ * not describe the first records of the trace. Returns 0 on success. */
+static int load_checkpoint(const char* trace, struct timestamp *ts,
+			   size_t count, struct sort_checkpoint* c)
+{
+	char name[4096];
+	void* mapped;
+	size_t size, nr_pending = 0;
+	int err = -1;
+
+	checkpoint_name(name, sizeof(name), trace);
+	if (access(name, F_OK) || map_file(name, &mapped, &size))
+		return -1;
+	if (size >= sizeof(*c)) {
+		memcpy(c, mapped, sizeof(*c));
+		nr_pending = (size - sizeof(*c)) / sizeof(*ts);
+	}
+	if (size >= sizeof(*c) &&
+	    !memcmp(c->magic, CHECKPOINT_MAGIC, sizeof(c->magic)) &&
+	    c->version == CHECKPOINT_VERSION &&
+	    c->nr_records && c->nr_records <= count &&
+	    c->resume < c->nr_records &&
+	    nr_pending == c->nr_records - c->resume &&
+	    c->window.nr_held <= nr_pending &&
+	    c->window.look_ahead >= 1 &&
+	    c->window.look_ahead <= MAX_LOOK_AHEAD &&
+	    !memcmp(ts + c->nr_records - 1, &c->last, sizeof(c->last))) {
+		ckpt_pending = malloc(nr_pending * sizeof(*ts));
+		if (!ckpt_pending) {
+			perror("malloc");
+			exit(1);
+		}
+		memcpy(ckpt_pending, (char*) mapped + sizeof(*c),
+		       nr_pending * sizeof(*ts));
+		err = 0;
+	}
+	if (mapped)
+		munmap(mapped, size);
+	return err;
+}
+
+static int write_checkpoint(const char* trace, struct sort_checkpoint* c,
+			    size_t nr_pending)
+{
+	char name[4096];
+	char* buf;
+	int err;
+
+	memcpy(c->magic, CHECKPOINT_MAGIC, sizeof(c->magic));
+	c->version = CHECKPOINT_VERSION;
+	buf = malloc(sizeof(*c) + nr_pending * sizeof(struct timestamp));
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+	memcpy(buf, c, sizeof(*c));
+	memcpy(buf + sizeof(*c), ckpt_pending,
+	       nr_pending * sizeof(struct timestamp));
+	checkpoint_name(name, sizeof(name), trace);
+	err = write_output(name, buf,
+			   sizeof(*c) + nr_pending * sizeof(struct timestamp));
+	free(buf);
+	return err;
+}
+
+static void remove_checkpoint(const char* trace)
+{
+	char name[4096];
+
+	checkpoint_name(name, sizeof(name), trace);
+	unlink(name);
+}
+
+/* How far records were out of order, and the window it took. */
+static void report_window(void)
+{
+	struct histogram* late = &stats.lateness;
+
+	fprintf(stderr,
+		"Window          : %10u - %u\n"
+		"Late            : %10llu\n",
+		stats.min_look_ahead, stats.max_look_ahead,
+		(unsigned long long) late->count);
+	if (!late->count)
+		return;
+	fprintf(stderr,
+		"Lateness p50    : %10llu\n"
+		"Lateness p90    : %10llu\n"
+		"Lateness p99    : %10llu\n"
+		"Lateness p99.9  : %10llu\n"
+		"Lateness max    : %10llu\n",
+		(unsigned long long) histogram_percentile(late, 50),
+		(unsigned long long) histogram_percentile(late, 90),
+		(unsigned long long) histogram_percentile(late, 99),
+		(unsigned long long) histogram_percentile(late, 99.9),
+		(unsigned long long) late->max);
 }
 
 #define USAGE							\
-	"Usage: ftsort [-e] [-s] [-v] [-c CYCLES] <logfile> \n"	\
+	"Usage: ftsort [-e] [-s | -o FILE] [-a] [-i] [-v] [-c CYCLES]\n" \
+	"              [-j THREADS] [-w RECORDS] <logfile> \n"	\
+	"       ftsort [-e] [-v] [-c CYCLES] [-w RECORDS] - \n"	\
+	"   -: pipe mode            -- sort records from stdin to stdout\n" \
 	"   -e: endianess swap      -- restores byte order \n"	\
 	"   -s: simulate            -- don't overwrite file\n"  \
+	"   -o: out of place        -- write the result to FILE instead\n" \
+	"   -a: incremental         -- sort only what was appended since the\n" \
+	"                              last run with -a (see <logfile>.ckpt)\n" \
+	"   -i: segment index       -- list the hole-free segments of the\n" \
+	"                              result in <result>.seg\n" \
 	"   -v: verbose             -- be chatty\n"		\
-	"   -c: CPU speed           -- cycles per nanosecond"	\
+	"   -c: CPU speed           -- cycles per nanosecond\n"	\
+	"   -j: threads             -- filter with the given number of threads\n" \
+	"   -w: reorder window      -- fixed size in records\n"	\
+	"                              (default: adapt to the trace)" \
 	"\n"							\
-	"WARNING: Changes are permanent, unless -s is specified.\n"
+	"WARNING: Changes are permanent, unless -s or -o is specified.\n"
 
 static void die(char* msg)
 {
@@ -371,15 +1258,23 @@ static void die(char* msg)
 	exit(1);
 }
 
-#define OPTS "esvc:"
+#define OPTS "eso:aivc:j:w:"
 
 int main(int argc, char** argv)
 {
 	void* mapped;
-	size_t size, count;
-	struct timestamp *ts, *end;
+	size_t size, count, written_size = 0;
+	size_t sorted = 0, resume = 0, next_resume, overlap, nr_held = 0;
+	struct reorder_snapshot snapshot;
+	struct timestamp *ts, *end, *ts_pos;
+	struct stat in_stat, out_stat;
+	const char* out_file = NULL;
+	struct segment_index segments, tail;
+	int want_index = 0;
+	int incremental = 0;
 	int swap_byte_order = 0;
 	int simulate = 0;
+	unsigned int look_ahead = 0;
 	int opt;
 	double start, stop;
 
@@ -391,6 +1286,15 @@ int main(int argc, char** argv)
 		case 's':
 			simulate = 1;
 			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'a':
+			incremental = 1;
+			break;
+		case 'i':
+			want_index = 1;
+			break;
 		case 'v':
 			want_verbose = 1;
 			break;
@@ -399,6 +1303,17 @@ int main(int argc, char** argv)
 			if (cycles_per_nanosecond <= 0)
 				die("Bad argument -c: need positive number.");
 			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			if (nr_threads < 1)
+				die("Bad argument -j: need positive number.");
+			break;
+		case 'w':
+			look_ahead = atoi(optarg);
+			if (!look_ahead || look_ahead > MAX_LOOK_AHEAD)
+				die("Bad argument -w: need window size of "
+				    "1 to 32768 records.");
+			break;
 		default:
 			die("Unknown option.");
 			break;
@@ -407,10 +1322,36 @@ int main(int argc, char** argv)
 
 	if (argc - optind != 1)
 		die("arguments missing");
-
+	if (simulate && out_file)
+		die("-s and -o cannot be combined.");
+	if (simulate && want_index)
+		die("-s and -i cannot be combined.");
+	if (incremental && out_file)
+		die("-a and -o cannot be combined.");
+
+	log_file = stdout;
+	init_reorder_stats(&stats);
 	start = wctime();
 
-	if (simulate) {
+	if (!strcmp(argv[optind], "-")) {
+		if (simulate || out_file || want_index || incremental)
+			die("-s, -o, -a, and -i cannot be used in pipe mode.");
+		log_file = stderr;
+		sort_stream(STDIN_FILENO, swap_byte_order, look_ahead);
+		count = stream_count;
+		size  = written_size = count * sizeof(struct timestamp);
+		goto report;
+	}
+
+	if (out_file && !stat(argv[optind], &in_stat) &&
+	    !stat(out_file, &out_stat) &&
+	    in_stat.st_dev == out_stat.st_dev &&
+	    in_stat.st_ino == out_stat.st_ino)
+		die("-o must name a file other than the trace.");
+
+	/* Out of place, modified pages are copied on write and never reach
+	 * the trace. */
+	if (simulate || out_file) {
 		if (map_file(argv[optind], &mapped, &size))
 			die("could not RO map file");
 	} else {
@@ -422,21 +1363,116 @@ int main(int argc, char** argv)
 	count = size / sizeof(struct timestamp);
 	end   = ts + count;
 
-	if (swap_byte_order)
-		restore_byte_order(ts, end);
+	if (!simulate && !out_file)
+		track_writes(mapped, size);
+
+	trace_end = end;
+	if (incremental && !load_checkpoint(argv[optind], ts, count, &ckpt)) {
+		sorted   = ckpt.nr_records;
+		resume   = ckpt.resume;
+		snapshot = ckpt.window;
+		nr_held  = snapshot.nr_held;
+		restore_state(&ckpt);
+	}
+	memset(&ckpt, 0, sizeof(ckpt));
+	overlap = look_ahead ? look_ahead : MAX_LOOK_AHEAD;
+	next_resume = count > overlap ? count - overlap : 0;
+
+	/* what was sorted before is in native byte order already */
+	if (swap_byte_order) {
+		ft_swap(ts + sorted, count - sorted);
+		if (dirty_pages)
+			memset(dirty_pages + sorted * sizeof(*ts) / page_size,
+			       1, (size - sorted * sizeof(*ts)) / page_size + 1);
+	}
 
-	pre_check_cpu_monotonicity(ts, end);
-	reorder(ts, end);
+	/* Segments before the resume point: the filter needs only the last
+	 * record, the index all of them. */
+	init_segment_index(&segments);
+	if (resume && (!want_index ||
+		       load_segment_index(argv[optind], ts, sorted, 1,
+					  &segments))) {
+		if (want_index)
+			segment_index_scan(&segments, ts, resume);
+		else
+			segment_index_add(&segments, resume - 1,
+					  ts[resume - 1].seq_no);
+	}
+	segment_index_truncate(&segments, resume);
+
+	if (sorted) {
+		/* put the records not pushed yet back where they were */
+		held_lo     = ckpt_pending;
+		held_hi     = ckpt_pending + nr_held;
+		unpushed_lo = ts + resume + nr_held;
+		unpushed_hi = ts + sorted;
+		memcpy(unpushed_lo, held_hi,
+		       (unpushed_hi - unpushed_lo) * sizeof(*ts));
+		for (ts_pos = unpushed_lo; ts_pos < unpushed_hi; ts_pos++)
+			written(ts_pos);
+	}
 
-	if (cycles_per_nanosecond)
-		filter_implausible_latencies(ts, end);
+	if (nr_threads > 1 && count - sorted > MIN_CHUNK_RECORDS)
+		pre_check_cpu_monotonicity_parallel(ts + sorted, end);
+	else
+		pre_check_cpu_monotonicity(ts + sorted, end);
+	save_check_state();
+
+	init_segment_index(&tail);
+	init_reorder_window(&window, &stats, want_verbose ? log_file : NULL);
+	window.segments = &tail;
+	if (look_ahead)
+		fix_reorder_window(&window, look_ahead);
+	if (held_lo)
+		reorder_restore(&window, &snapshot, held_lo);
+	reorder_through(&window, ts + resume + nr_held, end, written,
+			incremental ? ts + next_resume : NULL, save_window);
+	free_reorder_window(&window);
+	segment_index_append(&segments, &tail, resume);
+	free_segment_index(&tail);
+
+	if (cycles_per_nanosecond) {
+		/* the filter state is saved on the way */
+		if (incremental && next_resume && next_resume >= resume)
+			lp_snapshot_at = ts + next_resume - 1;
+		if (!incremental && nr_threads > 1 && count > MIN_CHUNK_RECORDS)
+			filter_implausible_latencies_parallel(ts, end);
+		else
+			filter_implausible_latencies(ts,
+						     ts + (resume ? resume - 1 : 0),
+						     end, &segments);
+	}
 
 	/* write back */
 	if (simulate)
 		fprintf(stderr, "Note: not writing back results.\n");
-	else
-		msync(ts, size, MS_SYNC | MS_INVALIDATE);
-
+	else if (out_file) {
+		if (write_output(out_file, mapped, size))
+			die("could not write output file");
+		written_size = size;
+	} else
+		written_size = write_back_dirty();
+
+	if (want_index &&
+	    write_segment_index(out_file ? out_file : argv[optind], ts,
+				&segments))
+		die("could not write segment index");
+	free_segment_index(&segments);
+
+	if (incremental && !simulate && ckpt_taken) {
+		ckpt.nr_records = count;
+		ckpt.resume     = next_resume;
+		ckpt.last       = ts[count - 1];
+		if (write_checkpoint(argv[optind], &ckpt, count - next_resume))
+			die("could not write checkpoint");
+	} else if (incremental && !simulate)
+		remove_checkpoint(argv[optind]);
+	free(ckpt_pending);
+	/* report on what was sorted */
+	count -= resume;
+	size  -= resume * sizeof(*ts);
+
+report:
 	stop = wctime();
 
 	fprintf(stderr,
@@ -447,14 +1483,22 @@ int main(int argc, char** argv)
 		"Seq. constraint : %10u\n"
 		"Implausible     : %10u\n"
 		"Size            : %10.2f Mb\n"
+		"Written         : %10.2f Mb\n"
 		"Time            : %10.2f s\n"
 		"Throughput      : %10.2f Mb/s\n",
 		(unsigned int) count,
-		holes, reordered, non_monotonic, aborted_moves,
+		stats.holes, stats.reordered, non_monotonic,
+		stats.aborted_moves,
 		implausible,
 		((double) size) / 1024.0 / 1024.0,
+		((double) written_size) / 1024.0 / 1024.0,
 		(stop - start),
 		((double) size) / 1024.0 / 1024.0 / (stop - start));
+	if (resume)
+		fprintf(stderr, "Resumed at      : %10llu\n",
+			(unsigned long long) resume);
+	report_window();
+	free_reorder_stats(&stats);
 
 	return 0;
 }
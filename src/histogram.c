@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "histogram.h"
+
+void init_histogram(struct histogram* h, unsigned int sub_bits)
+{
+	memset(h, 0, sizeof(*h));
+	h->sub_bits = sub_bits;
+}
+
+void free_histogram(struct histogram* h)
+{
+	free(h->counts);
+	h->counts    = NULL;
+	h->nr_counts = 0;
+}
+
+static unsigned int log2_floor(uint64_t value)
+{
+	return 63 - __builtin_clzll(value);
+}
+
+static size_t bucket_of(struct histogram* h, uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < (1ULL << h->sub_bits))
+		return value;
+	shift = log2_floor(value) - h->sub_bits;
+	/* the leading one bit selects the group, the next sub_bits bits the
+	 * bucket within the group */
+	return ((size_t) (shift + 1) << h->sub_bits) +
+		((value >> shift) & ((1ULL << h->sub_bits) - 1));
+}
+
+/* midpoint of the values counted in the bucket */
+static uint64_t value_of(struct histogram* h, size_t bucket)
+{
+	size_t group = bucket >> h->sub_bits;
+	uint64_t sub = bucket & ((1ULL << h->sub_bits) - 1);
+	uint64_t lower;
+
+	if (!group)
+		return bucket;
+	lower = ((1ULL << h->sub_bits) + sub) << (group - 1);
+	return lower + ((1ULL << (group - 1)) >> 1);
+}
+
+static void grow(struct histogram* h, size_t bucket)
+{
+	size_t size = h->nr_counts ? h->nr_counts : (2ULL << h->sub_bits);
+
+	while (size <= bucket)
+		size *= 2;
+	h->counts = realloc(h->counts, size * sizeof(uint64_t));
+	if (!h->counts) {
+		perror("realloc");
+		exit(1);
+	}
+	memset(h->counts + h->nr_counts, 0,
+	       (size - h->nr_counts) * sizeof(uint64_t));
+	h->nr_counts = size;
+}
+
+void histogram_add(struct histogram* h, uint64_t value)
+{
+	size_t bucket = bucket_of(h, value);
+
+	if (bucket >= h->nr_counts)
+		grow(h, bucket);
+	h->counts[bucket]++;
+
+	if (!h->count || value < h->min)
+		h->min = value;
+	if (!h->count || value > h->max)
+		h->max = value;
+	h->count++;
+	h->sum += value;
+}
+
+void histogram_merge(struct histogram* into, struct histogram* from)
+{
+	size_t i;
+
+	if (!from->count)
+		return;
+	if (from->nr_counts > into->nr_counts)
+		grow(into, from->nr_counts - 1);
+	for (i = 0; i < from->nr_counts; i++)
+		into->counts[i] += from->counts[i];
+
+	if (!into->count || from->min < into->min)
+		into->min = from->min;
+	if (!into->count || from->max > into->max)
+		into->max = from->max;
+	into->count += from->count;
+	into->sum   += from->sum;
+}
+
+uint64_t histogram_percentile(struct histogram* h, double p)
+{
+	uint64_t rank, seen = 0, value;
+	size_t i;
+
+	if (!h->count)
+		return 0;
+	/* nearest rank */
+	rank = p / 100.0 * h->count;
+	if (rank < p / 100.0 * h->count || rank < 1)
+		rank++;
+
+	for (i = 0; i < h->nr_counts; i++) {
+		seen += h->counts[i];
+		if (seen >= rank)
+			break;
+	}
+	value = value_of(h, i);
+	/* the extremes are known exactly */
+	if (value > h->max)
+		value = h->max;
+	if (value < h->min)
+		value = h->min;
+	return value;
+}
+
+double histogram_mean(struct histogram* h)
+{
+	return h->count ? h->sum / h->count : 0;
+}
@@ -48,6 +48,8 @@ int map_trace(const char *name, void **start, void **end, size_t *size)
 }
 
 
+enum trace_order load_order = TRACE_AUTO;
+
 static struct heap* heap_from_file(char* file, unsigned int* count)
 {
 	size_t s;
@@ -55,6 +57,10 @@ static struct heap* heap_from_file(char* file, unsigned int* count)
 	if (map_trace(file, (void**) &rec, (void**) &end, &s) == 0) {
 		*count = ((unsigned int)((char*) end - (char*) rec))
 			/ sizeof(struct st_event_record);
+		/* the mapping is private */
+		if (st_decode(rec, *count, load_order))
+			fprintf(stderr, "Note: converting %s from foreign "
+				"byte order.\n", file);
 		return heapify_events(rec, *count);
 	} else
 		fprintf(stderr, "mmap: %m (%s)\n", file);
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+
+#define OUTBUF_INITIAL_SIZE 4096
+
+const char outbuf_digit_pairs[200] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+void outbuf_init(struct outbuf* ob, int fd)
+{
+	ob->fd    = fd;
+	ob->buf   = NULL;
+	ob->size  = 0;
+	ob->fill  = 0;
+	ob->error = 0;
+}
+
+int outbuf_flush(struct outbuf* ob)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	if (ob->fd < 0)
+		return 0;
+
+	while (done < ob->fill && !ob->error) {
+		ret = write(ob->fd, ob->buf + done, ob->fill - done);
+		if (ret < 0 && errno != EINTR)
+			ob->error = errno;
+		else if (ret > 0)
+			done += ret;
+	}
+	/* on error, the remaining data is dropped */
+	ob->fill = 0;
+	return ob->error ? -1 : 0;
+}
+
+void outbuf_grow(struct outbuf* ob, size_t len)
+{
+	size_t size;
+
+	/* Buffers start small and grow up to the flush size, so that
+	 * rarely used outputs do not tie up much memory. */
+	if (ob->fd >= 0 && ob->fill + len > OUTBUF_FLUSH_SIZE)
+		outbuf_flush(ob);
+	if (ob->size - ob->fill >= len)
+		return;
+
+	size = ob->size ? ob->size : OUTBUF_INITIAL_SIZE;
+	while (size - ob->fill < len)
+		size *= 2;
+	ob->buf = realloc(ob->buf, size);
+	if (!ob->buf) {
+		perror("realloc");
+		exit(1);
+	}
+	ob->size = size;
+}
+
+int outbuf_release(struct outbuf* ob)
+{
+	int err = outbuf_flush(ob);
+
+	free(ob->buf);
+	ob->buf  = NULL;
+	ob->size = 0;
+	return err;
+}
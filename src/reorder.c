@@ -0,0 +1,720 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "reorder.h"
+
+/* records read from the stream at once */
+#define STREAM_BUFFER_RECORDS (64 * LOOK_AHEAD)
+
+#define NONE (-1)
+
+/* records that are cheaper to scan than to search for */
+#define SHORT_SCAN 128
+
+/* slots per record in the window */
+#define SLOTS_PER_RECORD 4
+/* records pushed between attempts to shrink the window, in windows */
+#define EPOCH_WINDOWS 64
+
+static uint32_t next_seq_number(uint32_t seqno)
+{
+	return seqno + 1;
+}
+
+/* How far candidate is ahead of seqno, modulo 2^32. Records less than
+ * look_ahead ahead of the expected sequence number are in range; among them,
+ * the distance orders the sequence numbers even across an overflow. */
+static uint32_t distance(uint32_t seqno, uint32_t candidate)
+{
+	return candidate - seqno;
+}
+
+static void* alloc_filled(size_t n, size_t size, int byte)
+{
+	void* mem = malloc(n * size);
+
+	if (!mem) {
+		perror("malloc");
+		exit(1);
+	}
+	memset(mem, byte, n * size);
+	return mem;
+}
+
+static void* realloc_or_die(void* mem, size_t n, size_t size)
+{
+	mem = realloc(mem, n * size);
+	if (!mem) {
+		perror("realloc");
+		exit(1);
+	}
+	return mem;
+}
+
+static void queue_append(struct reorder_queue* q, int32_t* next, int32_t slot)
+{
+	next[slot] = NONE;
+	if (q->last != NONE)
+		next[q->last] = slot;
+	else
+		q->first = slot;
+	q->last = slot;
+}
+
+static void queue_pop(struct reorder_queue* q, int32_t* next)
+{
+	q->first = next[q->first];
+	if (q->first == NONE)
+		q->last = NONE;
+}
+
+/* TS_SEND_RESCHED_START is recorded on a different CPU, so it is not subject
+ * to sequentiality constraints (see may_move()) and is not tracked. */
+static int constrains(const struct timestamp* ts)
+{
+	return ts->event != TS_SEND_RESCHED_START;
+}
+
+static void set_leaf(struct reorder_window* w, size_t slot, int held)
+{
+	struct seqno_range* leaf = w->tree + w->nr_slots + slot;
+
+	w->held[slot] = held;
+	leaf->min = held ? w->records[slot].seq_no : UINT32_MAX;
+	leaf->max = held ? w->records[slot].seq_no : 0;
+}
+
+static int update_node(struct seqno_range* t, size_t i)
+{
+	uint32_t min, max;
+
+	min = t[2 * i].min < t[2 * i + 1].min ? t[2 * i].min : t[2 * i + 1].min;
+	max = t[2 * i].max > t[2 * i + 1].max ? t[2 * i].max : t[2 * i + 1].max;
+	if (t[i].min == min && t[i].max == max)
+		return 0;
+	t[i].min = min;
+	t[i].max = max;
+	return 1;
+}
+
+static void propagate(struct reorder_window* w, size_t slot)
+{
+	size_t i;
+
+	for (i = (slot + w->nr_slots) / 2; i && update_node(w->tree, i); i /= 2)
+		;
+}
+
+/* Update the ancestors of the leaves [from, to) level by level. */
+static void sync_range(struct reorder_window* w, size_t from, size_t to)
+{
+	size_t i;
+
+	if (from >= to)
+		return;
+	for (from += w->nr_slots, to += w->nr_slots; from > 1; ) {
+		from /= 2;
+		to = (to - 1) / 2 + 1;
+		for (i = from; i < to; i++)
+			update_node(w->tree, i);
+	}
+}
+
+/* Records are pushed at the tail and mostly popped at the head, so these
+ * leaves are updated in batches just before the tree is searched. */
+static void sync_tree(struct reorder_window* w)
+{
+	sync_range(w, w->synced_head, w->head);
+	sync_range(w, w->synced_tail, w->tail);
+	w->synced_head = w->head;
+	w->synced_tail = w->tail;
+}
+
+static void build_tree(struct reorder_window* w)
+{
+	size_t i;
+
+	for (i = w->nr_slots - 1; i; i--)
+		update_node(w->tree, i);
+	w->synced_head = w->head;
+	w->synced_tail = w->tail;
+}
+
+static void clear_tree(struct reorder_window* w)
+{
+	size_t i;
+
+	for (i = 1; i < 2 * w->nr_slots; i++) {
+		w->tree[i].min = UINT32_MAX;
+		w->tree[i].max = 0;
+	}
+	memset(w->held, 0, w->nr_slots);
+}
+
+/* Last slot in [from, to) that holds a sequence number outside of [lo, hi],
+ * or NONE. */
+static int32_t last_outside(struct reorder_window* w, size_t node,
+			    size_t node_from, size_t node_to,
+			    size_t from, size_t to, uint32_t lo, uint32_t hi)
+{
+	size_t mid = node_from + (node_to - node_from) / 2;
+	int32_t found;
+
+	if (node_to <= from || to <= node_from ||
+	    (w->tree[node].min >= lo && w->tree[node].max <= hi))
+		return NONE;
+	if (node >= w->nr_slots)
+		return node_from;
+	found = last_outside(w, 2 * node + 1, mid, node_to, from, to, lo, hi);
+	if (found == NONE)
+		found = last_outside(w, 2 * node, node_from, mid,
+				     from, to, lo, hi);
+	return found;
+}
+
+/* Make the record in slot trackable. */
+static void insert(struct reorder_window* w, size_t slot)
+{
+	struct timestamp* ts = w->records + slot;
+
+	set_leaf(w, slot, 1);
+	if (constrains(ts)) {
+		queue_append(w->by_cpu + ts->cpu, w->cpu_next, slot);
+		if (ts_pid(ts))
+			queue_append(w->by_pid + ts_pid(ts), w->pid_next, slot);
+	}
+	w->nr_held++;
+}
+
+/* Only the first held record or a record that may_move() allowed to be
+ * moved is removed, so it is the first of its CPU and task. */
+static void remove_slot(struct reorder_window* w, size_t slot)
+{
+	struct timestamp* ts = w->records + slot;
+
+	set_leaf(w, slot, 0);
+	if (slot != w->head)
+		propagate(w, slot);
+	if (constrains(ts)) {
+		queue_pop(w->by_cpu + ts->cpu, w->cpu_next);
+		if (ts_pid(ts))
+			queue_pop(w->by_pid + ts_pid(ts), w->pid_next);
+	}
+	w->nr_held--;
+	while (w->head < w->tail && !w->held[w->head])
+		w->head++;
+}
+
+/* Move the held records to the first slots, keeping their order. */
+static void compact(struct reorder_window* w)
+{
+	size_t slot, nr = 0;
+	struct timestamp* ts;
+
+	for (slot = w->head; slot < w->tail; slot++) {
+		if (!w->held[slot])
+			continue;
+		ts = w->records + slot;
+		w->by_cpu[ts->cpu].first = w->by_cpu[ts->cpu].last = NONE;
+		w->by_pid[ts_pid(ts)].first = w->by_pid[ts_pid(ts)].last = NONE;
+		w->records[nr++] = *ts;
+	}
+	clear_tree(w);
+
+	w->head = 0;
+	w->tail = nr;
+	w->nr_held = 0;
+	for (slot = 0; slot < nr; slot++)
+		insert(w, slot);
+	build_tree(w);
+}
+
+/* Make room for SLOTS_PER_RECORD slots per record in a window of look_ahead
+ * records. The held records keep their slots until the window is compacted,
+ * which rebuilds everything else. */
+static void alloc_slots(struct reorder_window* w, unsigned int look_ahead)
+{
+	size_t nr_slots = w->nr_slots ? w->nr_slots : 1;
+
+	while (nr_slots < (size_t) SLOTS_PER_RECORD * look_ahead)
+		nr_slots *= 2;
+	if (nr_slots == w->nr_slots)
+		return;
+
+	w->records  = realloc_or_die(w->records, nr_slots,
+				     sizeof(struct timestamp));
+	w->cpu_next = realloc_or_die(w->cpu_next, nr_slots, sizeof(int32_t));
+	w->pid_next = realloc_or_die(w->pid_next, nr_slots, sizeof(int32_t));
+	w->tree     = realloc_or_die(w->tree, 2 * nr_slots,
+				     sizeof(struct seqno_range));
+	w->held     = realloc_or_die(w->held, nr_slots, 1);
+	if (!w->nr_slots) {
+		w->nr_slots = nr_slots;
+		clear_tree(w);
+	} else {
+		w->nr_slots = nr_slots;
+		compact(w);
+	}
+}
+
+static void set_look_ahead(struct reorder_window* w, unsigned int look_ahead)
+{
+	struct reorder_stats* stats = w->stats;
+
+	alloc_slots(w, look_ahead);
+	w->look_ahead = look_ahead;
+	w->epoch_left = (uint64_t) EPOCH_WINDOWS * look_ahead;
+	w->epoch_lateness = 0;
+	if (!stats->min_look_ahead || look_ahead < stats->min_look_ahead)
+		stats->min_look_ahead = look_ahead;
+	if (look_ahead > stats->max_look_ahead)
+		stats->max_look_ahead = look_ahead;
+}
+
+void init_reorder_stats(struct reorder_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	init_histogram(&stats->lateness, DEFAULT_HISTOGRAM_SUB_BITS);
+}
+
+void free_reorder_stats(struct reorder_stats* stats)
+{
+	free_histogram(&stats->lateness);
+}
+
+void init_reorder_window(struct reorder_window* w,
+			 struct reorder_stats* stats, FILE* log)
+{
+	memset(w, 0, sizeof(*w));
+	w->by_pid   = alloc_filled(1 << 16, sizeof(struct reorder_queue), 0xff);
+	memset(w->by_cpu, 0xff, sizeof(w->by_cpu));
+	w->stats    = stats;
+	w->log      = log;
+	w->adaptive = 1;
+	set_look_ahead(w, LOOK_AHEAD);
+}
+
+void fix_reorder_window(struct reorder_window* w, unsigned int look_ahead)
+{
+	w->adaptive = 0;
+	set_look_ahead(w, look_ahead);
+}
+
+void reorder_save(const struct reorder_window* w, struct reorder_snapshot* s,
+		  struct timestamp* held)
+{
+	size_t slot, nr = 0;
+
+	for (slot = w->head; slot < w->tail; slot++)
+		if (w->held[slot])
+			held[nr++] = w->records[slot];
+
+	memset(s, 0, sizeof(*s));
+	s->look_ahead     = w->look_ahead;
+	s->last_seqno     = w->last_seqno;
+	s->max_seqno      = w->max_seqno;
+	s->nr_far_ahead   = w->nr_far_ahead;
+	s->epoch_left     = w->epoch_left;
+	s->epoch_lateness = w->epoch_lateness;
+	s->popped         = w->count || w->resumed;
+	s->nr_held        = nr;
+}
+
+void reorder_restore(struct reorder_window* w,
+		     const struct reorder_snapshot* s,
+		     const struct timestamp* held)
+{
+	size_t i;
+
+	set_look_ahead(w, s->look_ahead);
+	for (i = 0; i < s->nr_held; i++) {
+		w->records[w->tail] = held[i];
+		insert(w, w->tail++);
+	}
+	w->last_seqno     = s->last_seqno;
+	w->max_seqno      = s->max_seqno;
+	w->nr_far_ahead   = s->nr_far_ahead;
+	w->epoch_left     = s->epoch_left;
+	w->epoch_lateness = s->epoch_lateness;
+	w->resumed        = s->popped;
+}
+
+void free_reorder_window(struct reorder_window* w)
+{
+	free(w->records);
+	free(w->by_pid);
+	free(w->cpu_next);
+	free(w->pid_next);
+	free(w->tree);
+	free(w->held);
+	memset(w, 0, sizeof(*w));
+}
+
+/* Record how late ts is and adapt the window to it. A record far ahead of
+ * all others is most likely corrupted, unless more of them follow. */
+static void track_lateness(struct reorder_window* w, const struct timestamp* ts)
+{
+	uint32_t ahead = ts->seq_no - w->max_seqno, late = 0;
+	unsigned int look_ahead = w->look_ahead;
+
+	if (!w->count && !w->resumed && !w->nr_held) {
+		w->max_seqno = ts->seq_no;
+	} else if (ahead && ahead <= INT32_MAX) {
+		if (ahead <= MAX_LOOK_AHEAD ||
+		    ++w->nr_far_ahead > MAX_NR_NOT_IN_RANGE) {
+			w->max_seqno = ts->seq_no;
+			w->nr_far_ahead = 0;
+		}
+	} else if (ahead) {
+		late = -ahead;
+		histogram_add(&w->stats->lateness, late);
+	}
+
+	if (!w->adaptive)
+		return;
+	if (late < MAX_LOOK_AHEAD) {
+		if (late > w->epoch_lateness)
+			w->epoch_lateness = late;
+		while (look_ahead <= 2 * late && look_ahead < MAX_LOOK_AHEAD)
+			look_ahead *= 2;
+		if (look_ahead != w->look_ahead) {
+			set_look_ahead(w, look_ahead);
+			return;
+		}
+	}
+	if (!--w->epoch_left) {
+		if (look_ahead > MIN_LOOK_AHEAD &&
+		    (uint64_t) 8 * w->epoch_lateness < look_ahead)
+			look_ahead /= 2;
+		set_look_ahead(w, look_ahead);
+	}
+}
+
+void reorder_push(struct reorder_window* w, const struct timestamp* ts)
+{
+	track_lateness(w, ts);
+	if (w->tail == w->nr_slots)
+		compact(w);
+	w->records[w->tail] = *ts;
+	insert(w, w->tail++);
+}
+
+struct search {
+	uint32_t seqno;
+	int32_t  min;
+	uint32_t min_dist;
+	int      nr_not_in_range;
+	/* tree search: lowest sequence number in range after the expected one,
+	 * and the record with the expected one */
+	uint32_t tree_min;
+	int32_t  exact;
+};
+
+/* Scan the held records in up to limit slots for the lowest in-range
+ * sequence number. Returns the slot at which the search must go on, or NONE
+ * if it is complete. */
+static int32_t scan_lowest_seq_no(struct reorder_window* w, uint32_t seqno,
+				  struct search* s, size_t limit)
+{
+	uint32_t dist;
+	size_t slot, end = w->tail;
+
+	if (end - w->head > limit)
+		end = w->head + limit;
+	for (slot = w->head; slot < end; slot++) {
+		if (!w->held[slot])
+			continue;
+		dist = distance(seqno, w->records[slot].seq_no);
+		/* pre-filter totally out-of-order samples */
+		if (dist < w->look_ahead) {
+			/* ties go to the last record */
+			if (dist <= s->min_dist) {
+				s->min = slot;
+				s->min_dist = dist;
+				if (!dist)
+					return NONE;
+			}
+		} else if (++s->nr_not_in_range > MAX_NR_NOT_IN_RANGE) {
+			s->min = NONE;
+			return NONE;
+		}
+	}
+	return slot < w->tail ? (int32_t) slot : NONE;
+}
+
+/* Visit the held records in [from, to) in order, skipping subtrees in
+ * which all sequence numbers are in range but not the expected one. Returns
+ * non-zero once the search is complete. */
+static int search_tree(struct reorder_window* w, struct search* s,
+		       size_t node, size_t node_from, size_t node_to,
+		       size_t from, size_t to)
+{
+	size_t mid = node_from + (node_to - node_from) / 2;
+	struct seqno_range* range = w->tree + node;
+	uint32_t hi = s->seqno + (w->look_ahead - 1);
+
+	if (node_to <= from || to <= node_from)
+		return 0;
+	if (range->min > s->seqno && range->max <= hi &&
+	    from <= node_from && node_to <= to) {
+		if (range->min < s->tree_min)
+			s->tree_min = range->min;
+		return 0;
+	}
+	if (node >= w->nr_slots) {
+		if (range->min == s->seqno) {
+			s->exact = node_from;
+			return 1;
+		}
+		if (++s->nr_not_in_range > MAX_NR_NOT_IN_RANGE) {
+			s->min = NONE;
+			return 1;
+		}
+		return 0;
+	}
+	return search_tree(w, s, 2 * node, node_from, mid, from, to) ||
+		search_tree(w, s, 2 * node + 1, mid, node_to, from, to);
+}
+
+/* Among the held records, find the first one with the expected sequence
+ * number or else the last one with the lowest sequence number in range. Give
+ * up if more than MAX_NR_NOT_IN_RANGE records out of range precede it. */
+static int32_t find_lowest_seq_no(struct reorder_window* w, uint32_t seqno)
+{
+	struct search s = {seqno, NONE, w->look_ahead, 0, UINT32_MAX, NONE};
+	uint32_t hi = seqno + (w->look_ahead - 1);
+	int32_t slot, start, to = w->tail;
+
+	/* Most searches end after a few records. The tree cannot be searched
+	 * if the range of sequence numbers wraps around. */
+	start = scan_lowest_seq_no(w, seqno, &s,
+				   hi == UINT32_MAX || hi < seqno ?
+				   w->nr_slots : SHORT_SCAN);
+	if (start == NONE)
+		return s.min;
+
+	sync_tree(w);
+	if (search_tree(w, &s, 1, 0, w->nr_slots, start, to))
+		return s.exact != NONE ? s.exact : s.min;
+	if (s.tree_min > hi || distance(seqno, s.tree_min) > s.min_dist)
+		return s.min;
+
+	/* ties go to the last record */
+	while ((slot = last_outside(w, 1, 0, w->nr_slots, start, to,
+				    s.tree_min + 1, hi)) != NONE &&
+	       w->records[slot].seq_no != s.tree_min)
+		to = slot;
+	return slot;
+}
+
+/* Refuse to violate task and CPU sequentiality: since CPUs and tasks execute
+ * sequentially, it makes no sense to move a timestamp before something
+ * recorded by the same task or CPU. */
+static int may_move(struct reorder_window* w, int32_t slot)
+{
+	struct timestamp *ts = w->records + slot, *prev;
+	int32_t first = NONE, other;
+
+	if (!constrains(ts))
+		return 1;
+	other = w->by_cpu[ts->cpu].first;
+	if (other < slot)
+		first = other;
+	if (ts_pid(ts)) {
+		other = w->by_pid[ts_pid(ts)].first;
+		if (other < slot && (first == NONE || other < first))
+			first = other;
+	}
+	if (first == NONE)
+		return 1;
+
+	/* Bail out before we cause more disturbance to the stream. */
+	w->stats->aborted_moves++;
+	prev = w->records + first;
+	if (w->log)
+		fprintf(w->log, "Sequentiality constraint:\n"
+			"\t<ev:%s seq:%u pid:%u cpu:%u at %llu>\n"
+			"\tmust come before\n"
+			"\t<ev:%s seq:%u pid:%u cpu:%u at %llu>\n",
+			event2str(prev->event),
+			prev->seq_no, ts_pid(prev), prev->cpu,
+			(unsigned long long) ts_timestamp(prev),
+			event2str(ts->event),
+			ts->seq_no, ts_pid(ts), ts->cpu,
+			(unsigned long long) ts_timestamp(ts));
+	return 0;
+}
+
+/* The slot of the record to emit in place of the first held record, which
+ * does not carry the expected sequence number. */
+static int32_t reorder_at(struct reorder_window* w, uint32_t expected_seqno)
+{
+	int32_t slot, pos = w->head;
+
+	slot = find_lowest_seq_no(w, expected_seqno);
+	if (slot != NONE && slot != pos && may_move(w, slot)) {
+		/* Good, we found next-best candidate. */
+		pos = slot;
+		w->stats->reordered++;
+	}
+
+	/* check if the sequence number lines up now */
+	if (expected_seqno != w->records[pos].seq_no) {
+		/* bad, there's a hole here */
+		w->stats->holes++;
+		if (w->log)
+			fprintf(w->log, "HOLE: %u instead of %u\n",
+				w->records[pos].seq_no, expected_seqno);
+	}
+	return pos;
+}
+
+int reorder_pop(struct reorder_window* w, struct timestamp* ts)
+{
+	uint32_t expected_seqno;
+	int32_t pos = w->head;
+
+	if (!w->nr_held)
+		return 0;
+
+	/* check for for holes in the sequence number */
+	expected_seqno = next_seq_number(w->last_seqno);
+	if ((w->count || w->resumed) &&
+	    expected_seqno != w->records[pos].seq_no)
+		pos = reorder_at(w, expected_seqno);
+
+	*ts = w->records[pos];
+	remove_slot(w, pos);
+	if (w->segments)
+		segment_index_add(w->segments, w->count, ts->seq_no);
+	w->last_seqno = ts->seq_no;
+	w->count++;
+	return 1;
+}
+
+/* Store ts at out unless it is there already. */
+static void write_back(struct timestamp* out, const struct timestamp* ts,
+		       void (*written)(struct timestamp* ts))
+{
+	if (!memcmp(out, ts, sizeof(*ts)))
+		return;
+	*out = *ts;
+	if (written)
+		written(out);
+}
+
+void reorder_through(struct reorder_window* w,
+		     struct timestamp* start, struct timestamp* end,
+		     void (*written)(struct timestamp* ts),
+		     struct timestamp* snapshot_at,
+		     void (*snapshot)(struct reorder_window* w,
+				      struct timestamp* in))
+{
+	struct timestamp *in, *out = start - w->nr_held, tmp;
+
+	/* No more records are popped than pushed, so they can be written back
+	 * in place. */
+	for (in = start; in != end; in++) {
+		reorder_push(w, in);
+		while (reorder_window_full(w)) {
+			if (out == snapshot_at && snapshot)
+				snapshot(w, in + 1);
+			if (!reorder_pop(w, &tmp))
+				break;
+			write_back(out++, &tmp, written);
+		}
+	}
+	while (w->nr_held) {
+		if (out == snapshot_at && snapshot)
+			snapshot(w, end);
+		reorder_pop(w, &tmp);
+		write_back(out++, &tmp, written);
+	}
+}
+
+void reorder(struct timestamp* start, struct timestamp* end,
+	     unsigned int look_ahead,
+	     struct reorder_stats* stats, FILE* log,
+	     void (*written)(struct timestamp* ts))
+{
+	struct reorder_window w;
+
+	init_reorder_window(&w, stats, log);
+	if (look_ahead)
+		fix_reorder_window(&w, look_ahead);
+	reorder_through(&w, start, end, written, NULL, NULL);
+	free_reorder_window(&w);
+}
+
+void init_reorder_stream(struct reorder_stream* s, int fd)
+{
+	memset(s, 0, sizeof(*s));
+	s->fd       = fd;
+	s->order    = TRACE_NATIVE;
+	s->capacity = STREAM_BUFFER_RECORDS;
+	s->buf      = alloc_filled(s->capacity, sizeof(struct timestamp), 0);
+	init_reorder_stats(&s->stats);
+	init_reorder_window(&s->window, &s->stats, NULL);
+}
+
+void free_reorder_stream(struct reorder_stream* s)
+{
+	free(s->buf);
+	s->buf = NULL;
+	free_reorder_window(&s->window);
+	free_reorder_stats(&s->stats);
+}
+
+static void refill(struct reorder_stream* s)
+{
+	size_t size = s->capacity * sizeof(struct timestamp);
+	char* bytes = (char*) s->buf;
+	ssize_t ret;
+	size_t n;
+
+	/* keep a partial record */
+	s->fill -= s->pos * sizeof(struct timestamp);
+	memmove(bytes, s->buf + s->pos, s->fill);
+	s->pos = 0;
+
+	while (!s->eof && s->fill < sizeof(struct timestamp)) {
+		ret = read(s->fd, bytes + s->fill, size - s->fill);
+		if (ret > 0)
+			s->fill += ret;
+		else if (ret == 0)
+			s->eof = 1;
+		else if (errno != EINTR) {
+			perror("read");
+			s->eof = 1;
+		}
+	}
+
+	/* all complete records are new */
+	n = s->fill / sizeof(struct timestamp);
+	if (s->order == TRACE_AUTO && n)
+		s->order = ft_looks_swapped(s->buf, n) ?
+			TRACE_SWAPPED : TRACE_NATIVE;
+	if (s->order == TRACE_SWAPPED)
+		ft_swap(s->buf, n);
+}
+
+struct timestamp* reorder_next(struct reorder_stream* s)
+{
+	s->window.log = s->log;
+	while (!reorder_window_full(&s->window)) {
+		if (s->pos == s->fill / sizeof(struct timestamp)) {
+			if (s->eof)
+				break;
+			refill(s);
+			continue;
+		}
+		reorder_push(&s->window, s->buf + s->pos++);
+	}
+
+	if (!reorder_pop(&s->window, &s->current))
+		return NULL;
+	s->count++;
+	return &s->current;
+}
@@ -0,0 +1,95 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "samples.h"
+
+static char byte_order(void)
+{
+	uint16_t probe = 1;
+
+	return *((uint8_t*) &probe) ? '<' : '>';
+}
+
+static unsigned int width_of(uint64_t sample)
+{
+	if (sample <= UINT16_MAX)
+		return 2;
+	else if (sample <= UINT32_MAX)
+		return 4;
+	else
+		return 8;
+}
+
+static void write_segment(uint64_t* sample, uint64_t count, uint64_t in_class,
+			  unsigned int width, struct outbuf* out)
+{
+	struct sample_header hdr;
+	uint64_t i;
+	size_t pad;
+	char* buf;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SAMPLES_MAGIC, sizeof(hdr.magic));
+	snprintf(hdr.dtype, sizeof(hdr.dtype), "%cu%u", byte_order(), width);
+	hdr.nr_samples = in_class;
+	outbuf_write(out, &hdr, sizeof(hdr));
+
+	for (i = 0; i < count; i++) {
+		if (width_of(sample[i]) != width)
+			continue;
+		switch (width) {
+		case 2: {
+			uint16_t val = sample[i];
+			outbuf_write(out, &val, sizeof(val));
+			break;
+		}
+		case 4: {
+			uint32_t val = sample[i];
+			outbuf_write(out, &val, sizeof(val));
+			break;
+		}
+		default:
+			outbuf_write(out, sample + i, sizeof(uint64_t));
+		}
+	}
+
+	/* keep the next segment aligned */
+	pad = (8 - (in_class * width) % 8) % 8;
+	buf = outbuf_reserve(out, pad);
+	memset(buf, 0, pad);
+	out->fill += pad;
+}
+
+int write_samples(int spool, struct outbuf* out)
+{
+	struct stat info;
+	uint64_t* sample;
+	uint64_t count, i;
+	uint64_t in_class[9] = {0};
+	unsigned int width;
+
+	if (fstat(spool, &info))
+		return -1;
+	count = info.st_size / sizeof(uint64_t);
+	/* nothing to append */
+	if (!count)
+		return 0;
+
+	sample = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, spool, 0);
+	if (sample == MAP_FAILED)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		in_class[width_of(sample[i])]++;
+
+	for (width = 2; width <= 8; width *= 2)
+		if (in_class[width])
+			write_segment(sample, count, in_class[width], width,
+				      out);
+
+	munmap(sample, info.st_size);
+	return out->error ? -1 : 0;
+}
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "segments.h"
+
+void init_segment_index(struct segment_index* idx)
+{
+	memset(idx, 0, sizeof(*idx));
+}
+
+void free_segment_index(struct segment_index* idx)
+{
+	free(idx->segs);
+	init_segment_index(idx);
+}
+
+static void reserve_segments(struct segment_index* idx, size_t nr)
+{
+	if (nr <= idx->size)
+		return;
+	idx->size = idx->size ? 2 * idx->size : 64;
+	if (idx->size < nr)
+		idx->size = nr;
+	idx->segs = realloc(idx->segs, idx->size * sizeof(struct segment));
+	if (!idx->segs) {
+		perror("realloc");
+		exit(1);
+	}
+}
+
+void segment_index_open(struct segment_index* idx, uint64_t pos,
+			uint32_t seq_no)
+{
+	struct segment* s;
+
+	reserve_segments(idx, idx->nr + 1);
+	s = idx->segs + idx->nr++;
+	s->first    = pos;
+	s->count    = 1;
+	s->seq_no   = seq_no;
+	s->reserved = 0;
+	idx->nr_records = pos + 1;
+}
+
+void segment_index_scan(struct segment_index* idx, const struct timestamp* ts,
+			size_t count)
+{
+	uint64_t base = idx->nr ? idx->nr_records : 0;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		segment_index_add(idx, base + i, ts[i].seq_no);
+}
+
+void segment_index_truncate(struct segment_index* idx, uint64_t count)
+{
+	while (idx->nr && idx->segs[idx->nr - 1].first >= count)
+		idx->nr--;
+	if (idx->nr && idx->segs[idx->nr - 1].first +
+	    idx->segs[idx->nr - 1].count > count)
+		idx->segs[idx->nr - 1].count =
+			count - idx->segs[idx->nr - 1].first;
+	idx->nr_records = idx->nr ? count : 0;
+}
+
+void segment_index_append(struct segment_index* idx,
+			  const struct segment_index* src, uint64_t offset)
+{
+	const struct segment* s;
+	struct segment* last;
+	size_t i;
+
+	for (i = 0; i < src->nr; i++) {
+		s = src->segs + i;
+		last = idx->nr ? idx->segs + idx->nr - 1 : NULL;
+		if (last && last->seq_no + (uint32_t) last->count == s->seq_no)
+			last->count += s->count;
+		else {
+			segment_index_open(idx, offset + s->first, s->seq_no);
+			idx->segs[idx->nr - 1].count = s->count;
+		}
+	}
+	if (src->nr)
+		idx->nr_records = offset + src->nr_records;
+}
+
+const struct segment* segment_of(const struct segment_index* idx,
+				 uint64_t pos)
+{
+	size_t lo = 0, hi = idx->nr, mid;
+
+	/* last segment that starts at or before pos */
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (idx->segs[mid].first <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return idx->segs + lo;
+}
+
+static char* index_name(const char* trace)
+{
+	char* name = malloc(strlen(trace) + sizeof(SEGMENTS_EXT));
+
+	if (!name) {
+		perror("malloc");
+		exit(1);
+	}
+	strcpy(name, trace);
+	strcat(name, SEGMENTS_EXT);
+	return name;
+}
+
+static int write_all(int fd, const void* data, size_t size)
+{
+	const char* pos = data;
+	ssize_t ret;
+
+	while (size) {
+		ret = write(fd, pos, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		pos  += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+/* FNV-1a over the sequence numbers and first words of evenly spaced
+ * records; cheap enough to compute whenever an index is loaded. */
+static uint32_t trace_checksum(const struct timestamp* ts, uint64_t count)
+{
+	uint64_t stride = count / SEGMENTS_CHECKSUM_SAMPLES + 1, i;
+	uint32_t sum = 2166136261u;
+
+	for (i = 0; i < count; i += stride) {
+		sum = (sum ^ ts[i].seq_no) * 16777619u;
+		sum = (sum ^ (uint32_t) ts[i].word) * 16777619u;
+		sum = (sum ^ (uint32_t) (ts[i].word >> 32)) * 16777619u;
+	}
+	return sum;
+}
+
+static int stat_trace(const char* trace, uint64_t* size, uint64_t* mtime)
+{
+	struct stat info;
+
+	if (stat(trace, &info))
+		return -1;
+	*size  = info.st_size;
+	*mtime = info.st_mtim.tv_sec * 1000000000ULL + info.st_mtim.tv_nsec;
+	return 0;
+}
+
+int write_segment_index(const char* trace, const struct timestamp* ts,
+			const struct segment_index* idx)
+{
+	struct segment_header hdr;
+	char* name;
+	int fd, err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SEGMENTS_MAGIC, sizeof(hdr.magic));
+	hdr.version     = SEGMENTS_VERSION;
+	hdr.checksum    = trace_checksum(ts, idx->nr_records);
+	hdr.nr_records  = idx->nr_records;
+	hdr.nr_segments = idx->nr;
+	if (stat_trace(trace, &hdr.trace_size, &hdr.trace_mtime)) {
+		perror(trace);
+		return -1;
+	}
+
+	name = index_name(trace);
+
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror(name);
+		free(name);
+		return -1;
+	}
+	err = write_all(fd, &hdr, sizeof(hdr)) ||
+		write_all(fd, idx->segs, idx->nr * sizeof(struct segment));
+	if (err)
+		perror(name);
+	err = close(fd) || err;
+	free(name);
+	return err ? -1 : 0;
+}
+
+static int read_all(int fd, void* data, size_t size)
+{
+	char* pos = data;
+	ssize_t ret;
+
+	while (size) {
+		ret = read(fd, pos, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		pos  += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+/* Do the segments tile the trace, and do their ends carry the sequence
+ * numbers that they claim? */
+static int matches_trace(const struct segment_index* idx,
+			 const struct timestamp* ts, size_t count)
+{
+	const struct segment* s;
+	uint64_t next = 0;
+	size_t i;
+
+	for (i = 0; i < idx->nr; i++) {
+		s = idx->segs + i;
+		if (s->first != next || !s->count || s->count > count - next ||
+		    ts[s->first].seq_no != s->seq_no ||
+		    ts[s->first + s->count - 1].seq_no !=
+		    s->seq_no + (uint32_t) (s->count - 1))
+			return 0;
+		next += s->count;
+	}
+	return next == count;
+}
+
+int load_segment_index(const char* trace, const struct timestamp* ts,
+		       size_t count, int appended, struct segment_index* idx)
+{
+	struct segment_header hdr;
+	char* name = index_name(trace);
+	uint64_t size, mtime;
+	int fd, err = -1;
+
+	init_segment_index(idx);
+	fd = open(name, O_RDONLY);
+	free(name);
+	if (fd < 0)
+		return -1;
+
+	if (read_all(fd, &hdr, sizeof(hdr)) ||
+	    memcmp(hdr.magic, SEGMENTS_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != SEGMENTS_VERSION ||
+	    hdr.nr_records != count || hdr.nr_segments > count)
+		goto out;
+	if (!appended &&
+	    (stat_trace(trace, &size, &mtime) ||
+	     size != hdr.trace_size || mtime != hdr.trace_mtime))
+		goto out;
+	if (hdr.checksum != trace_checksum(ts, count))
+		goto out;
+
+	reserve_segments(idx, hdr.nr_segments);
+	if (read_all(fd, idx->segs, hdr.nr_segments * sizeof(struct segment)))
+		goto out;
+	idx->nr = hdr.nr_segments;
+	idx->nr_records = hdr.nr_records;
+	if (matches_trace(idx, ts, count))
+		err = 0;
+out:
+	close(fd);
+	if (err)
+		free_segment_index(idx);
+	return err;
+}
@@ -18,6 +18,8 @@ static void usage(const char *str)
 		"     -f         -- use first non-zero event as system release\n"
 		"                   if no system release event is found\n"
 		"     -c         -- display a count of the number of events\n"
+		"     -O ORDER   -- byte order: auto (default), native, or\n"
+		"                   swapped\n"
 		"\n\n"
 		);
 	if (str) {
@@ -28,7 +30,7 @@ static void usage(const char *str)
 	}
 }
 
-#define OPTSTR "rcfh"
+#define OPTSTR "rcfhO:"
 
 int main(int argc, char** argv)
 {
@@ -53,6 +55,10 @@ int main(int argc, char** argv)
 		case 'f':
 			use_first_nonzero = 1;
 			break;
+		case 'O':
+			if (parse_trace_order(optarg, &load_order))
+				usage("Bad byte order.");
+			break;
 		case 'h':
 			usage(NULL);
 			break;
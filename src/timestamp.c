@@ -73,3 +73,34 @@ const char* task_type2str(int task_type)
 	else
 		return "UNKNOWN";
 }
+
+void ts_unpack(const struct timestamp* ts, size_t count,
+	       const struct ts_columns* cols)
+{
+	size_t i;
+
+	if (cols->timestamp)
+		for (i = 0; i < count; i++)
+			cols->timestamp[i] = ts_timestamp(ts + i);
+	if (cols->pid)
+		for (i = 0; i < count; i++)
+			cols->pid[i] = ts_pid(ts + i);
+	if (cols->seq_no)
+		for (i = 0; i < count; i++)
+			cols->seq_no[i] = ts[i].seq_no;
+	if (cols->cpu)
+		for (i = 0; i < count; i++)
+			cols->cpu[i] = ts[i].cpu;
+	if (cols->event)
+		for (i = 0; i < count; i++)
+			cols->event[i] = ts[i].event;
+	if (cols->task_type)
+		for (i = 0; i < count; i++)
+			cols->task_type[i] = ts_task_type(ts + i);
+	if (cols->irq_flag)
+		for (i = 0; i < count; i++)
+			cols->irq_flag[i] = ts_irq_flag(ts + i);
+	if (cols->irq_count)
+		for (i = 0; i < count; i++)
+			cols->irq_count[i] = ts_irq_count(ts + i);
+}